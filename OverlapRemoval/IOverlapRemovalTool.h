@@ -1,9 +1,18 @@
 #ifndef OVERLAPREMOVAL_IOVERLAPREMOVALTOOL_H
 #define OVERLAPREMOVAL_IOVERLAPREMOVALTOOL_H
 
+// System includes
+#include <vector>
+
 // Framework includes
 #include "AsgTools/IAsgTool.h"
 
+// EDM includes
+#include "xAODBase/IParticle.h"
+
+// Local includes
+#include "OverlapRemoval/OverlapSurvivorViews.h"
+
 // Put the tool in a namespace?
 
 /// Interface for the overlap removal tool
@@ -43,6 +52,46 @@ class IOverlapRemovalTool : public virtual asg::IAsgTool
                                       const xAOD::MuonContainer* looseMuons,
                                       const xAOD::PhotonContainer* photons = 0) = 0;
 
+    /// Check if an object overlaps with another object in the event.
+    /// With lazy evaluation, removeOverlaps only records its inputs.
+    /// Electrons, taus and photons are then decided one by one; muons and
+    /// jets need (nearly) the whole sequence to be run.
+    virtual StatusCode isOverlapping(const xAOD::IParticle* obj,
+                                     bool& overlaps) = 0;
+
+    /// Get the first n surviving objects of a type, in container order.
+    /// With lazy evaluation, the sequence is run up to the last step
+    /// deciding this object type.
+    virtual StatusCode getSurvivingObjects
+    (xAOD::Type::ObjectType type, size_t n,
+     std::vector<const xAOD::IParticle*>& survivors) = 0;
+
+    /// Get pT-ordered views of the objects surviving the last call to
+    /// removeOverlaps. Requires the SurvivorViews property. The views are
+    /// owned by the tool and valid until the next removeOverlaps.
+    virtual StatusCode getSurvivorViews
+    (const OverlapSurvivorViews*& views) = 0;
+
+    /// Find the surviving object of a type closest to obj, using the
+    /// rapidity-based dR of the overlap removal. nearest is set to null
+    /// if there is no such object. Valid until the next removeOverlaps.
+    virtual StatusCode findNearestSurvivor(const xAOD::IParticle* obj,
+                                           xAOD::Type::ObjectType type,
+                                           const xAOD::IParticle*& nearest,
+                                           double& dR) = 0;
+
+    /// Find all surviving objects of a type within dRMax of obj, using the
+    /// rapidity-based dR of the overlap removal.
+    /// Valid until the next removeOverlaps.
+    virtual StatusCode findSurvivorsInCone
+    (const xAOD::IParticle* obj, xAOD::Type::ObjectType type, double dRMax,
+     std::vector<const xAOD::IParticle*>& found) = 0;
+
+    /// Check if the last call to removeOverlaps vetoed the event.
+    /// The steps following a veto are skipped, so the decorations of a
+    /// vetoed event are incomplete.
+    virtual bool isEventVetoed() const = 0;
+
     /// Remove overlapping electrons and jets.
     /// This method will decorate both the electrons and jets according to
     /// both the e-jet and jet-e overlap removal prescriptions
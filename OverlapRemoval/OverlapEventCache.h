@@ -0,0 +1,156 @@
+#ifndef OVERLAPREMOVAL_OVERLAPEVENTCACHE_H
+#define OVERLAPREMOVAL_OVERLAPEVENTCACHE_H
+
+// System includes
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+
+// EDM includes
+#include "AthContainers/AuxElement.h"
+#include "xAODBase/IParticle.h"
+
+/// Per-event cache of object kinematics used by the fast matching engine.
+///
+/// Rapidity and phi are computed once per object per event and kept in flat
+/// arrays keyed by the owning container and the object index, so an object
+/// seen through several view containers maps onto a single slot.
+/// For each container scanned by the tool a rapidity-sorted index is built
+/// on first use, which turns a dR query into a binary search plus a short
+/// scan over the objects inside the rapidity window.
+///
+/// Pair distances are memoized per pair of owning containers, so a pair
+/// tested by several steps (e.g. the two passes of the ele-jet OR) is only
+/// computed once. The memo is a dense matrix for small multiplicities and
+/// a hash map otherwise.
+///
+/// The cache knows nothing about event boundaries; the owner must call
+/// clear() at the start of every event. Memory is kept between events.
+class OverlapEventCache
+{
+
+  public:
+
+    /// Cached kinematics of one object
+    struct Kinematics
+    {
+      double rapidity;
+      double phi;
+    };
+
+    /// One entry of a rapidity-sorted container index
+    struct IndexEntry
+    {
+      double rapidity;
+      const xAOD::IParticle* obj;
+      /// Position of the object in the indexed container
+      size_t position;
+    };
+    typedef std::vector<IndexEntry> SortedIndex;
+    typedef std::pair<SortedIndex::const_iterator,
+                      SortedIndex::const_iterator> IndexRange;
+
+    /// Default constructor
+    OverlapEventCache();
+
+    /// Forget the cached content. Call this at the start of every event.
+    void clear();
+
+    /// Cached kinematics of an object, computed on first use
+    Kinematics kinematics(const xAOD::IParticle* obj);
+
+    /// (delta R)^2 from the pair memo, computed from the cached kinematics
+    /// on first use. Gives exactly the same result as
+    /// OverlapRemovalTool::deltaR2.
+    double deltaR2(const xAOD::IParticle* p1, const xAOD::IParticle* p2);
+
+    /// Rapidity-sorted index of a container, built on first use
+    template<typename ContainerType>
+    const SortedIndex& sortedIndex(const ContainerType* container)
+    {
+      bool isNew = false;
+      SortedIndex& index = findIndex(container, isNew);
+      if(isNew){
+        size_t position = 0;
+        for(const auto obj : *container){
+          IndexEntry entry = { kinematics(obj).rapidity, obj, position++ };
+          index.push_back(entry);
+        }
+        std::sort(index.begin(), index.end(), compareRapidity);
+      }
+      return index;
+    }
+
+    /// Range of index entries that can lie within dR of the given rapidity.
+    /// Empty for a negative dR.
+    static IndexRange window(const SortedIndex& index, double rapidity,
+                             double dR);
+
+    /// First index entry with a rapidity not below the given one
+    static SortedIndex::const_iterator lowerBound(const SortedIndex& index,
+                                                  double rapidity);
+
+  private:
+
+    /// Kinematics of all objects of one owning container
+    struct ContainerKinematics
+    {
+      const SG::AuxVectorData* container;
+      std::vector<Kinematics> kin;
+      std::vector<char> filled;
+    };
+
+    /// Memoized (delta R)^2 between the objects of two owning containers.
+    /// Unfilled entries hold a negative value.
+    struct PairMemo
+    {
+      const SG::AuxVectorData* first;
+      const SG::AuxVectorData* second;
+      size_t nFirst;
+      size_t nSecond;
+      bool isDense;
+      std::vector<double> dense;
+      std::unordered_map<uint64_t, double> sparse;
+    };
+
+    /// Largest number of pairs stored as a dense matrix
+    static const size_t maxDenseSize = 16384;
+
+    /// Sorted index of one (possibly view) container
+    struct ContainerIndex
+    {
+      const void* container;
+      SortedIndex index;
+    };
+
+    /// Find or create the index slot for a container
+    SortedIndex& findIndex(const void* container, bool& isNew);
+
+    /// Find or create the kinematics slot for an owning container
+    ContainerKinematics& findKinematics(const SG::AuxVectorData* container);
+
+    /// Find or create the memo for a pair of owning containers
+    PairMemo& findMemo(const SG::AuxVectorData* first,
+                       const SG::AuxVectorData* second);
+
+    /// Compute (delta R)^2 from the cached kinematics
+    double computeDeltaR2(const xAOD::IParticle* p1,
+                          const xAOD::IParticle* p2);
+
+    static bool compareRapidity(const IndexEntry& a, const IndexEntry& b)
+    { return a.rapidity < b.rapidity; }
+
+    /// Slots are recycled between events to avoid reallocations,
+    /// so only the first m_nKinematics/m_nIndices/m_nMemos entries are valid.
+    std::vector<ContainerKinematics> m_kinematics;
+    std::vector<ContainerIndex> m_indices;
+    std::vector<PairMemo> m_memos;
+    size_t m_nKinematics;
+    size_t m_nIndices;
+    size_t m_nMemos;
+
+}; // class OverlapEventCache
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef OVERLAPREMOVAL_OVERLAPREMOVALTOOL_H
 #define OVERLAPREMOVAL_OVERLAPREMOVALTOOL_H
 
+// System includes
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
 // Framework includes
 #include "AsgTools/AsgTool.h"
 
@@ -14,6 +19,8 @@
 
 // Local includes
 #include "OverlapRemoval/IOverlapRemovalTool.h"
+#include "OverlapRemoval/OverlapEventCache.h"
+#include "OverlapRemoval/OverlapSurvivorViews.h"
 
 // Put the tool in a namespace?
 
@@ -37,6 +44,9 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
     /// Constructor for standalone usage
     OverlapRemovalTool(const std::string& name);
 
+    /// Destructor; prints the validation and matching summaries if enabled
+    virtual ~OverlapRemovalTool();
+
     /// @name Methods implementing the asg::IAsgTool interface
     /// @{
 
@@ -48,13 +58,14 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
     /// @name Methods implementing the IOverlapRemovalTool interface
     /// @{
 
-    // TODO: add better documentation about the loose ele/mu requirements.
-
     /// Top-level method for performing full overlap-removal.
     /// The individual OR methods will be called in the recommended order,
     /// and the considered objects will be decorated with the output result.
     /// Use this method form when the electron and muon containers are
-    /// sufficiently loose for the tau-lep overlap removal.
+    /// sufficiently loose for the tau-lep overlap removal, or when the loose
+    /// leptons are marked with the LooseElectronLabel and LooseMuonLabel
+    /// decorations. The labels replace the InputLabel selection of the
+    /// leptons in the tau-lep overlap removal.
     virtual StatusCode removeOverlaps(const xAOD::ElectronContainer* electrons,
                                       const xAOD::MuonContainer* muons,
                                       const xAOD::JetContainer* jets,
@@ -75,6 +86,104 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
                                       const xAOD::MuonContainer* looseMuons,
                                       const xAOD::PhotonContainer* photons = 0);
 
+    /// Check if an object overlaps with another object in the event.
+    /// In lazy mode an electron, tau or photon is decided on its own,
+    /// comparing it only to its possible partners, and no step is run;
+    /// the cost is that of one object instead of whole containers. Muons
+    /// and jets are only decided in the last steps, so for them, and for
+    /// all types when an event veto is configured, the sequence is run up
+    /// to the last step deciding the type, which is nearly all of it. The
+    /// steps run are kept for the rest of the event.
+    virtual StatusCode isOverlapping(const xAOD::IParticle* obj,
+                                     bool& overlaps);
+
+    /// Get the first n surviving objects of a type, in container order.
+    /// In lazy mode the sequence is run up to the last step deciding this
+    /// type: only the tau-lepton steps for taus, all but the muon-jet and
+    /// photon-jet steps for electrons, and (nearly) all of it for muons,
+    /// jets and photons. The steps run are kept for the rest of the event.
+    virtual StatusCode getSurvivingObjects
+    (xAOD::Type::ObjectType type, size_t n,
+     std::vector<const xAOD::IParticle*>& survivors);
+
+    /// Get pT-ordered views of the objects surviving the last call to
+    /// removeOverlaps. Requires the SurvivorViews property. The views are
+    /// filled on the first call of each event, so they cost nothing in
+    /// events which don't ask for them, and are empty for vetoed events.
+    /// In lazy mode this runs the full sequence.
+    virtual StatusCode getSurvivorViews(const OverlapSurvivorViews*& views);
+
+    /// Find the surviving object of a type closest to obj, using the
+    /// rapidity-based dR of the overlap removal. nearest is set to null
+    /// if there is no such object, and the call fails if the type is not
+    /// an OR input. The search uses the per-event sorted index and
+    /// kinematics cache, valid until the next removeOverlaps.
+    virtual StatusCode findNearestSurvivor(const xAOD::IParticle* obj,
+                                           xAOD::Type::ObjectType type,
+                                           const xAOD::IParticle*& nearest,
+                                           double& dR);
+
+    /// Find all surviving objects of a type within dRMax of obj, using the
+    /// rapidity-based dR of the overlap removal. The objects are ordered
+    /// by rapidity; the call fails if the type is not an OR input. Valid
+    /// until the next removeOverlaps.
+    virtual StatusCode findSurvivorsInCone
+    (const xAOD::IParticle* obj, xAOD::Type::ObjectType type, double dRMax,
+     std::vector<const xAOD::IParticle*>& found);
+
+    /// @name Partner decoration
+    /// With the PartnerLabel property set, each object decided by a step
+    /// gets a uint32_t decoration identifying the object which removed it:
+    /// the ORInputSlot of the input container holding the partner, plus
+    /// one, in the upper 16 bits and the position of the partner in that
+    /// container in the lower 16 bits. The slot is the role of the container in the step,
+    /// e.g. the partner of a tau removed by the tau-ele OR is in the
+    /// LooseElectronInput, even if that is the electron container. For the
+    /// individual removeXxxOverlap methods the slot names the argument.
+    /// Positions beyond the 16 bit range are stored as partnerIndexMask.
+    /// If several objects overlap, the partner is the first one in
+    /// container order, whichever matching engine runs. Objects which pass
+    /// get noPartner, which is 0, so objects never decided by the tool
+    /// also read as having no partner.
+    /// @{
+
+    /// Input containers a partner can come from
+    enum ORInputSlot {
+      ElectronInput,
+      MuonInput,
+      JetInput,
+      TauInput,
+      LooseElectronInput,
+      LooseMuonInput,
+      PhotonInput
+    };
+
+    static const uint32_t partnerIndexMask = 0xffff;
+    static const uint32_t noPartner = 0;
+
+    /// Encode the partner decoration of an object
+    static uint32_t encodePartner(ORInputSlot slot, size_t position);
+    /// Input slot of an encoded partner
+    static ORInputSlot partnerSlot(uint32_t code)
+    { return static_cast<ORInputSlot>((code >> 16) - 1); }
+    /// Position of an encoded partner in its input container
+    static size_t partnerIndex(uint32_t code)
+    { return code & partnerIndexMask; }
+
+    /// @}
+
+    /// Check if the last call to removeOverlaps vetoed the event.
+    /// The steps following a veto are skipped, so the decorations of a
+    /// vetoed event are incomplete. In lazy mode the veto conditions
+    /// are only checked when their steps are evaluated.
+    virtual bool isEventVetoed() const
+    { return m_eventVetoed; }
+
+    /// Number of decisions, or partners if recorded, on which the matching
+    /// engines disagreed so far in ValidationMode
+    unsigned long validationMismatches() const
+    { return m_valMismatches; }
+
     /// Remove overlapping electrons and jets
     /// This method will decorate both the electrons and jets according to
     /// both the e-jet and jet-e overlap removal prescriptions.
@@ -85,9 +194,8 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
     virtual StatusCode removeMuonJetOverlap(const xAOD::MuonContainer* muons,
                                             const xAOD::JetContainer* jets);
 
-    /// Remove overlapping electrons and muons
-    /// TODO: make it possible to veto event based on this.
-    /// Maybe the return value should just be a bool.
+    /// Remove overlapping electrons and muons.
+    /// Use the VetoEleMuonOverlap property to veto the event instead.
     virtual StatusCode removeEleMuonOverlap(const xAOD::ElectronContainer* electrons,
                                             const xAOD::MuonContainer* muons);
 
@@ -124,23 +232,207 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
 
   protected:
 
+    /// Steps of the full OR sequence
+    enum ORStep {
+      TauEleStep,
+      TauMuonStep,
+      EleMuonStep,
+      PhotonEleStep,
+      PhotonMuonStep,
+      EleJetStep,
+      MuonJetStep,
+      PhotonJetStep
+    };
+
+    /// Settings and per-event state of one OR working point
+    struct ORConfig
+    {
+      /// Output decoration which specifies overlapping objects
+      std::string overlapLabel;
+      /// Output decoration with the partner of rejected objects
+      std::string partnerLabel;
+      /// Overlap cones, see the corresponding properties
+      float electronJetDR;
+      float jetElectronDR;
+      float muonJetDR;
+      float tauJetDR;
+      float tauElectronDR;
+      float tauMuonDR;
+      float photonElectronDR;
+      float photonMuonDR;
+      float photonPhotonDR;
+      float photonJetDR;
+      /// Electron ID selection for tau-ele OR
+      std::string tauEleOverlapID;
+      /// Decorators of the output labels; partnerDec is null if disabled
+      std::shared_ptr<SG::AuxElement::Decorator<int> > overlapDec;
+      std::shared_ptr<SG::AuxElement::Decorator<uint32_t> > partnerDec;
+      /// Set when an electron-muon shared track is found in this event
+      bool eleMuonOverlapFound;
+    };
+
+    /// Check that initialize has set up the working points
+    StatusCode checkInitialized();
+
+    /// Parse a working point given as "<OverlapLabel> <Property>=<value> ..."
+    StatusCode parseWorkingPoint(const std::string& spec, ORConfig& config);
+
+    /// Find a working point cone by its property name
+    static float* coneByName(ORConfig& config, const std::string& name);
+
+    /// Input containers of the full OR sequence
+    struct ORInputs
+    {
+      const xAOD::ElectronContainer* electrons;
+      const xAOD::MuonContainer* muons;
+      const xAOD::JetContainer* jets;
+      const xAOD::TauJetContainer* taus;
+      const xAOD::ElectronContainer* looseElectrons;
+      const xAOD::MuonContainer* looseMuons;
+      const xAOD::PhotonContainer* photons;
+    };
+
+    /// Fill the recommended sequence of steps for the given inputs
+    void buildSequence(const ORInputs& inputs, std::vector<ORStep>& steps);
+
+    /// Run a single step of the sequence
+    StatusCode runStep(ORStep step, const ORInputs& inputs);
+
+    /// Choose the matching engine of a step from the sizes of its inputs
+    /// and count the choice
+    bool chooseFastMatching(ORStep step, const ORInputs& inputs);
+
+    /// Check if a step matches through objectOverlaps, which can use the
+    /// sorted index
+    static bool stepUsesIndex(ORStep step);
+
+    /// Number of object pairs compared through objectOverlaps by a step
+    static double stepPairs(ORStep step, const ORInputs& inputs);
+
+    /// Measure the number of object pairs from which the sorted index beats
+    /// the brute-force loop, timing objectOverlaps with both engines on
+    /// synthetic jets and the given cone
+    double calibrateCrossover(double dR);
+
+    /// Run the steps of the current event up to step nSteps,
+    /// continuing after the steps already done
+    StatusCode runSequence(size_t nSteps);
+
+    /// Run the steps needed to decide all objects of a type
+    StatusCode evaluateObjectType(xAOD::Type::ObjectType type);
+
+    /// Decide a single electron, tau or photon in lazy mode without
+    /// running the pending steps; decided is false if it can't
+    StatusCode decideObject(const xAOD::IParticle* obj,
+                            bool& decided, bool& overlaps);
+
+    /// Check if a step of the current event is still to be run
+    bool stepPending(ORStep step);
+
+    /// Check if an electron survives the ele-mu step
+    bool survivesEleMuon(const xAOD::Electron* electron);
+
+    /// Check if a jet survives the jet removal of the ele-jet step
+    bool survivesEleJet(const xAOD::Jet* jet);
+
+    /// Check if a step can change the decisions of an object type
+    static bool stepDecides(ORStep step, xAOD::Type::ObjectType type);
+
+    /// Sorted index of the input container of a type; null if not given.
+    /// Fails for types which are not OR inputs.
+    StatusCode inputIndex(xAOD::Type::ObjectType type,
+                          const OverlapEventCache::SortedIndex*& index);
+
+    /// Add the first surviving objects of a container to a list
+    template<typename ContainerType>
+    void collectSurvivors(const ContainerType* container, size_t n,
+                          std::vector<const xAOD::IParticle*>& survivors)
+    {
+      if(!container) return;
+      for(const auto obj : *container){
+        if(survivors.size() >= n) break;
+        if(isSurvivingObject(obj)) survivors.push_back(obj);
+      }
+    }
+
+    /// Run the full sequence with both matching engines and compare the
+    /// decisions step by step. The reference decisions are kept.
+    StatusCode validateSequence(const ORInputs& inputs,
+                                const std::vector<ORStep>& steps);
+
+    /// Readable name of a sequence step
+    static const char* stepName(ORStep step);
+
+    /// Fill the survivor views from the current decisions
+    void fillSurvivorViews();
+
+    /// Refill one survivor view, reusing its buffer
+    template<typename ContainerType>
+    void fillSurvivorView(const ContainerType* container,
+                          ConstDataVector<ContainerType>& view)
+    {
+      view.clear(SG::VIEW_ELEMENTS);
+      if(!container) return;
+      view.reserve(container->size());
+      for(const auto obj : *container)
+        if(isSurvivingObject(obj)) view.push_back(obj);
+      view.sort(higherPt);
+    }
+
+    /// Ordering of the survivor views
+    static bool higherPt(const xAOD::IParticle* p1, const xAOD::IParticle* p2)
+    { return p1->pt() > p2->pt(); }
+
+    /// Check if a step removes jets
+    static bool isJetStep(ORStep step)
+    { return step == EleJetStep || step == MuonJetStep || step == PhotonJetStep; }
+
+    /// Check the event veto conditions after the i-th step of the sequence
+    bool checkEventVeto(const ORInputs& inputs,
+                        const std::vector<ORStep>& steps, size_t i);
+
+    /// Decorate the veto decision on the EventInfo, if requested
+    StatusCode decorateEventVeto();
+
+    /// Check if any object of a container is still surviving
+    template<typename ContainerType>
+    bool hasSurvivingObject(const ContainerType* container)
+    {
+      for(const auto obj : *container)
+        if(isSurvivingObject(obj)) return true;
+      return false;
+    }
+
+    /// Result of objectOverlaps when nothing overlaps
+    static const size_t noOverlap = static_cast<size_t>(-1);
+
     /// Generic dR-based overlap check between one object and a container.
-    /// NOTE: this doesn't have any check that the objects are equal.
+    /// Returns the position in the container of the first overlapping
+    /// object, or noOverlap.
     /// TODO: decide if generic overlap function is worth it.
     /// TODO: can I just use DataVector inheritance here???
-    template<typename ContainerType> bool objectOverlaps
+    template<typename ContainerType> size_t objectOverlaps
     (const xAOD::IParticle* obj, const ContainerType* container, double dR)
     {
+      if(m_useFastMatching)
+        return objectOverlapsFast(obj, m_cache.sortedIndex(container), dR);
+      size_t position = 0;
       for(const auto contObj : *container){
-        if(isSurvivingObject(contObj)){
-          // Make sure these are not the same object
-          if(obj == contObj) continue;
-          if(objectsOverlap(obj, contObj, dR)) return true;
-        }
+        // Make sure these are not the same object
+        if(isSurvivingObject(contObj) && obj != contObj &&
+           objectsOverlap(obj, contObj, dR)) return position;
+        ++position;
       }
-      return false;
+      return noOverlap;
     }
 
+    /// Fast-engine version of objectOverlaps using the cached sorted index.
+    /// Gives the same position as the reference loop when the partner is
+    /// recorded or validated; otherwise that of any overlapping object.
+    size_t objectOverlapsFast(const xAOD::IParticle* obj,
+                              const OverlapEventCache::SortedIndex& index,
+                              double dR);
+
     /// Determine if objects overlap by a simple dR comparison
     bool objectsOverlap(const xAOD::IParticle* p1, const xAOD::IParticle* p2,
                         double dRMax, double dRMin = 0);
@@ -163,8 +455,26 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
     bool isSurvivingObject(const xAOD::IParticle* obj)
     { return isInputObject(obj) && !isRejectedObject(obj); }
 
-    /// Set output decoration on object, pass or fail
-    void setOverlapDecoration(const xAOD::IParticle* obj, int overlaps);
+    /// Check if a lepton is surviving as input to the tau-lep OR.
+    /// If a loose label accessor is given, it replaces the input label.
+    bool isSurvivingLooseLepton(const xAOD::IParticle* obj,
+                                const SG::AuxElement::ConstAccessor<int>* looseAcc)
+    {
+      if(!looseAcc) return isSurvivingObject(obj);
+      return (*looseAcc)(*obj) && !isRejectedObject(obj);
+    }
+
+    /// Get the current output decoration of an object
+    int getOverlapDecoration(const xAOD::IParticle* obj);
+
+    /// Get the current partner decoration of an object;
+    /// noPartner if disabled or not set
+    uint32_t getPartnerDecoration(const xAOD::IParticle* obj);
+
+    /// Set output decoration on object, pass or fail.
+    /// The encoded partner of a failing object is recorded if requested.
+    void setOverlapDecoration(const xAOD::IParticle* obj, int overlaps,
+                              uint32_t partner = noPartner);
     //void setOutputDecoration(const xAOD::IParticle* obj, int pass);
 
     /// Shorthand way to set an object as pass
@@ -173,8 +483,9 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
     //{ setOutputDecoration(obj, 1); }
 
     /// Shorthand way to set an object as fail
-    void setObjectFail(const xAOD::IParticle* obj)
-    { setOverlapDecoration(obj, 1); }
+    void setObjectFail(const xAOD::IParticle* obj,
+                       uint32_t partner = noPartner)
+    { setOverlapDecoration(obj, 1, partner); }
     //{ setOutputDecoration(obj, 0); }
 
   private:
@@ -189,6 +500,8 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
     //std::string m_outputLabel;
     /// Output object decoration which specifies overlapping objects
     std::string m_overlapLabel;
+    /// Output object decoration with the partner of rejected objects
+    std::string m_partnerLabel;
 
     /// electron-jet overlap cone (removes electron)
     float m_electronJetDR;
@@ -213,6 +526,95 @@ class OverlapRemovalTool : public virtual IOverlapRemovalTool,
 
     /// Electron ID selection for tau-ele OR
     std::string m_tauEleOverlapID;
+    /// Extra working points, "<OverlapLabel> <Property>=<value> ..."
+    std::vector<std::string> m_workingPoints;
+    /// Input decoration which marks loose electrons for tau-ele OR
+    std::string m_looseElectronLabel;
+    /// Input decoration which marks loose muons for tau-mu OR
+    std::string m_looseMuonLabel;
+
+    /// Veto events with an electron-muon shared track
+    bool m_vetoEleMuonOverlap;
+    /// Veto events without surviving electrons or muons after the lepton steps
+    bool m_vetoNoLeptons;
+    /// EventInfo decoration for the veto flag; disabled if empty
+    std::string m_eventVetoLabel;
+
+    /// Use the cached-kinematics matching engine in removeOverlaps
+    bool m_fastMatching;
+    /// Run both matching engines and report any disagreement
+    bool m_validationMode;
+    /// Defer the OR steps until the results are queried
+    bool m_lazyEvaluation;
+    /// Fill pT-ordered views of the surviving objects
+    bool m_survivorViews;
+    /// Choose the matching engine per step and event from the input sizes
+    bool m_adaptiveMatching;
+    /// Object pairs from which a step uses the sorted index;
+    /// negative to calibrate at initialize
+    double m_matchingCrossover;
+
+    //
+    // Event processing state
+    //
+
+    /// All working points; the first one is given by the tool properties
+    std::vector<ORConfig> m_configs;
+    /// Working point of the running step. Points to the primary working
+    /// point outside of the steps.
+    ORConfig* m_config;
+
+    /// Accessors of the loose lepton labels; null if not configured
+    std::unique_ptr<SG::AuxElement::ConstAccessor<int> > m_looseElectronAcc;
+    std::unique_ptr<SG::AuxElement::ConstAccessor<int> > m_looseMuonAcc;
+    /// Decorator of the EventVetoLabel; null if not configured
+    std::unique_ptr<SG::AuxElement::Decorator<int> > m_eventVetoDec;
+
+    /// Matching engine used by the running step
+    bool m_useFastMatching;
+    /// Take the distances of the running step from the per-event cache.
+    /// Set for all steps run by the sequence.
+    bool m_useDistanceCache;
+    /// Per-event kinematics cache of the fast engine
+    OverlapEventCache m_cache;
+    /// Inputs of the current event
+    ORInputs m_inputs;
+    /// Sequence of the current event; reused to avoid reallocations
+    std::vector<ORStep> m_sequence;
+    /// Number of steps of the sequence already run for this event
+    size_t m_nStepsDone;
+    /// Veto decision of the current event
+    bool m_eventVetoed;
+    /// Survivor views of the current event; buffers reused between events
+    OverlapSurvivorViews m_views;
+    /// Set once the survivor views are filled for the current event
+    bool m_viewsFilled;
+
+    //
+    // Validation bookkeeping
+    //
+
+    /// Objects compared in validation mode and their decisions
+    std::vector<const xAOD::IParticle*> m_valObjects;
+    std::vector<int> m_valBefore;
+    std::vector<int> m_valRef;
+    std::vector<uint32_t> m_valPartnerBefore;
+    std::vector<uint32_t> m_valPartnerRef;
+    /// Accumulated statistics of validation mode
+    unsigned long m_valEvents;
+    unsigned long m_valMismatches;
+    double m_valRefTime;
+    double m_valFastTime;
+
+    //
+    // Adaptive matching bookkeeping
+    //
+
+    /// Crossover used for the matching choice, calibrated or configured
+    double m_crossover;
+    /// Number of steps run with each engine, indexed by ORStep
+    std::vector<unsigned long> m_bruteForceSteps;
+    std::vector<unsigned long> m_indexSteps;
 
 }; // class OverlapRemovalTool
 
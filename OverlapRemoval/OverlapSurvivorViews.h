@@ -0,0 +1,34 @@
+#ifndef OVERLAPREMOVAL_OVERLAPSURVIVORVIEWS_H
+#define OVERLAPREMOVAL_OVERLAPSURVIVORVIEWS_H
+
+// EDM includes
+#include "AthContainers/ConstDataVector.h"
+#include "xAODEgamma/ElectronContainer.h"
+#include "xAODEgamma/PhotonContainer.h"
+#include "xAODJet/JetContainer.h"
+#include "xAODMuon/MuonContainer.h"
+#include "xAODTau/TauJetContainer.h"
+
+/// View containers of the objects surviving the overlap removal,
+/// ordered by decreasing pT.
+///
+/// The views are owned by the tool and refilled on the first request of
+/// every event. Their buffers keep their capacity, so once the largest
+/// multiplicities have been seen no further allocations happen. The views
+/// of an input which wasn't given to removeOverlaps are empty.
+struct OverlapSurvivorViews
+{
+  OverlapSurvivorViews()
+    : electrons(SG::VIEW_ELEMENTS), muons(SG::VIEW_ELEMENTS),
+      jets(SG::VIEW_ELEMENTS), taus(SG::VIEW_ELEMENTS),
+      photons(SG::VIEW_ELEMENTS)
+  {}
+
+  ConstDataVector<xAOD::ElectronContainer> electrons;
+  ConstDataVector<xAOD::MuonContainer> muons;
+  ConstDataVector<xAOD::JetContainer> jets;
+  ConstDataVector<xAOD::TauJetContainer> taus;
+  ConstDataVector<xAOD::PhotonContainer> photons;
+};
+
+#endif
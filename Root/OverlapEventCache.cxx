@@ -0,0 +1,184 @@
+// ROOT includes
+#include "TVector2.h"
+
+// Local includes
+#include "OverlapRemoval/OverlapEventCache.h"
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+OverlapEventCache::OverlapEventCache()
+        : m_nKinematics(0), m_nIndices(0), m_nMemos(0)
+{}
+
+//-----------------------------------------------------------------------------
+// Reset for a new event. The slots are kept to reuse their memory.
+//-----------------------------------------------------------------------------
+void OverlapEventCache::clear()
+{
+  m_nKinematics = 0;
+  m_nIndices = 0;
+  m_nMemos = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Get the cached rapidity and phi of an object
+//-----------------------------------------------------------------------------
+OverlapEventCache::Kinematics
+OverlapEventCache::kinematics(const xAOD::IParticle* obj)
+{
+  // Objects outside of a container can't be cached
+  const SG::AuxVectorData* container = obj->container();
+  if(!container){
+    Kinematics kin = { obj->rapidity(), obj->phi() };
+    return kin;
+  }
+  ContainerKinematics& slot = findKinematics(container);
+  const size_t idx = obj->index();
+  if(idx >= slot.kin.size()){
+    slot.kin.resize(idx + 1);
+    slot.filled.resize(idx + 1, 0);
+  }
+  if(!slot.filled[idx]){
+    slot.kin[idx].rapidity = obj->rapidity();
+    slot.kin[idx].phi = obj->phi();
+    slot.filled[idx] = 1;
+  }
+  return slot.kin[idx];
+}
+
+//-----------------------------------------------------------------------------
+// Get delta R squared from the pair memo, filling it on first use
+//-----------------------------------------------------------------------------
+double OverlapEventCache::deltaR2(const xAOD::IParticle* p1,
+                                  const xAOD::IParticle* p2)
+{
+  const SG::AuxVectorData* c1 = p1->container();
+  const SG::AuxVectorData* c2 = p2->container();
+  if(!c1 || !c2) return computeDeltaR2(p1, p2);
+  // Both orderings of a pair share one memo entry;
+  // dR^2 is exactly symmetric, so the swap doesn't change the result.
+  if(c2 < c1 || (c1 == c2 && p2->index() < p1->index())){
+    std::swap(p1, p2);
+    std::swap(c1, c2);
+  }
+  PairMemo& memo = findMemo(c1, c2);
+  const size_t i1 = p1->index();
+  const size_t i2 = p2->index();
+  if(memo.isDense && i1 < memo.nFirst && i2 < memo.nSecond){
+    double& dR2 = memo.dense[i1*memo.nSecond + i2];
+    if(dR2 < 0) dR2 = computeDeltaR2(p1, p2);
+    return dR2;
+  }
+  const uint64_t key = (static_cast<uint64_t>(i1) << 32) | i2;
+  auto it = memo.sparse.find(key);
+  if(it != memo.sparse.end()) return it->second;
+  const double dR2 = computeDeltaR2(p1, p2);
+  memo.sparse[key] = dR2;
+  return dR2;
+}
+
+//-----------------------------------------------------------------------------
+// Calculate delta R squared from the cached kinematics.
+// Keep this in sync with OverlapRemovalTool::deltaR2.
+//-----------------------------------------------------------------------------
+double OverlapEventCache::computeDeltaR2(const xAOD::IParticle* p1,
+                                         const xAOD::IParticle* p2)
+{
+  const Kinematics k1 = kinematics(p1);
+  const Kinematics k2 = kinematics(p2);
+  double dY = k1.rapidity - k2.rapidity;
+  double dPhi = TVector2::Phi_mpi_pi(k1.phi - k2.phi);
+  return dY*dY + dPhi*dPhi;
+}
+
+//-----------------------------------------------------------------------------
+// Select the index entries inside the rapidity window.
+// The small margin protects against rounding at the window edges;
+// the exact decision is always made on dR^2 by the caller.
+// A negative dR gives an empty range.
+//-----------------------------------------------------------------------------
+OverlapEventCache::IndexRange
+OverlapEventCache::window(const SortedIndex& index, double rapidity, double dR)
+{
+  if(dR < 0) return IndexRange(index.end(), index.end());
+  const double halfWidth = dR + 1e-6;
+  IndexEntry low = { rapidity - halfWidth, 0, 0 };
+  IndexEntry high = { rapidity + halfWidth, 0, 0 };
+  return IndexRange(std::lower_bound(index.begin(), index.end(), low,
+                                     compareRapidity),
+                    std::upper_bound(index.begin(), index.end(), high,
+                                     compareRapidity));
+}
+
+//-----------------------------------------------------------------------------
+// Find the start of a nearest-neighbour search in the index
+//-----------------------------------------------------------------------------
+OverlapEventCache::SortedIndex::const_iterator
+OverlapEventCache::lowerBound(const SortedIndex& index, double rapidity)
+{
+  IndexEntry value = { rapidity, 0, 0 };
+  return std::lower_bound(index.begin(), index.end(), value, compareRapidity);
+}
+
+//-----------------------------------------------------------------------------
+// Find the sorted index of a container, or prepare an empty one
+//-----------------------------------------------------------------------------
+OverlapEventCache::SortedIndex&
+OverlapEventCache::findIndex(const void* container, bool& isNew)
+{
+  for(size_t i = 0; i < m_nIndices; ++i){
+    if(m_indices[i].container == container){
+      isNew = false;
+      return m_indices[i].index;
+    }
+  }
+  if(m_nIndices == m_indices.size()) m_indices.push_back(ContainerIndex());
+  ContainerIndex& slot = m_indices[m_nIndices++];
+  slot.container = container;
+  slot.index.clear();
+  isNew = true;
+  return slot.index;
+}
+
+//-----------------------------------------------------------------------------
+// Find the kinematics slot of an owning container, or prepare an empty one
+//-----------------------------------------------------------------------------
+OverlapEventCache::ContainerKinematics&
+OverlapEventCache::findKinematics(const SG::AuxVectorData* container)
+{
+  for(size_t i = 0; i < m_nKinematics; ++i){
+    if(m_kinematics[i].container == container) return m_kinematics[i];
+  }
+  if(m_nKinematics == m_kinematics.size())
+    m_kinematics.push_back(ContainerKinematics());
+  ContainerKinematics& slot = m_kinematics[m_nKinematics++];
+  slot.container = container;
+  slot.kin.clear();
+  slot.filled.clear();
+  return slot;
+}
+
+//-----------------------------------------------------------------------------
+// Find the memo of a pair of owning containers, or prepare an empty one
+//-----------------------------------------------------------------------------
+OverlapEventCache::PairMemo&
+OverlapEventCache::findMemo(const SG::AuxVectorData* first,
+                            const SG::AuxVectorData* second)
+{
+  for(size_t i = 0; i < m_nMemos; ++i){
+    if(m_memos[i].first == first && m_memos[i].second == second)
+      return m_memos[i];
+  }
+  if(m_nMemos == m_memos.size()) m_memos.push_back(PairMemo());
+  PairMemo& memo = m_memos[m_nMemos++];
+  memo.first = first;
+  memo.second = second;
+  memo.nFirst = first->size_v();
+  memo.nSecond = second->size_v();
+  memo.isDense = memo.nFirst * memo.nSecond <= maxDenseSize;
+  if(memo.isDense) memo.dense.assign(memo.nFirst * memo.nSecond, -1.);
+  else memo.dense.clear();
+  memo.sparse.clear();
+  return memo;
+}
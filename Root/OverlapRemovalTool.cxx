@@ -1,20 +1,82 @@
+// System includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <unordered_set>
+
 // EDM includes
 #include "AthContainers/AuxElement.h"
+#include "xAODEventInfo/EventInfo.h"
+#include "xAODJet/JetAuxContainer.h"
 
 // Local includes
 #include "OverlapRemoval/OverlapRemovalTool.h"
 
+namespace
+{
+  /// Append the objects of a container which are not yet in the list
+  template<typename ContainerType>
+  void collectObjects(const ContainerType* container,
+                      std::vector<const xAOD::IParticle*>& objects,
+                      std::unordered_set<const xAOD::IParticle*>& seen)
+  {
+    if(!container) return;
+    for(const auto obj : *container)
+      if(seen.insert(obj).second) objects.push_back(obj);
+  }
+
+  /// Check if an object belongs to an optional input container
+  template<typename ContainerType>
+  bool inContainer(const ContainerType* container,
+                   const xAOD::IParticle* obj)
+  {
+    return container &&
+      std::find(container->begin(), container->end(), obj) != container->end();
+  }
+
+  /// Size of an optional input container
+  template<typename ContainerType>
+  double inputSize(const ContainerType* container)
+  { return container ? container->size() : 0; }
+
+  /// Short name of the object type for printouts
+  const char* typeName(const xAOD::IParticle* obj)
+  {
+    switch(obj->type()){
+      case xAOD::Type::Electron: return "electron";
+      case xAOD::Type::Muon: return "muon";
+      case xAOD::Type::Jet: return "jet";
+      case xAOD::Type::Tau: return "tau";
+      case xAOD::Type::Photon: return "photon";
+      default: return "object";
+    }
+  }
+}
+
 //-----------------------------------------------------------------------------
 // Standard constructor
 //-----------------------------------------------------------------------------
 OverlapRemovalTool::OverlapRemovalTool(const std::string& name)
-        : asg::AsgTool(name)
+        : asg::AsgTool(name),
+          m_config(0), m_useFastMatching(false), m_useDistanceCache(false),
+          m_inputs(), m_nStepsDone(0),
+          m_eventVetoed(false), m_viewsFilled(false),
+          m_valEvents(0), m_valMismatches(0),
+          m_valRefTime(0), m_valFastTime(0),
+          m_crossover(0)
 {
   // input/output labels
   declareProperty("InputLabel", m_inputLabel = "selected");
   //declareProperty("OutputLabel", m_outputLabel = "passesOR");
   declareProperty("OverlapLabel", m_overlapLabel = "overlaps",
                   "Decoration given to objects that fail OR");
+  declareProperty("PartnerLabel", m_partnerLabel = "",
+                  "Decoration with the partner which removed an object; "
+                  "empty disables");
   // dR cones for defining overlap
   declareProperty("ElectronJetDRCone",    m_electronJetDR    = 0.2);
   declareProperty("JetElectronDRCone",    m_jetElectronDR    = 0.4);
@@ -31,6 +93,65 @@ OverlapRemovalTool::OverlapRemovalTool(const std::string& name)
   // TODO: figure out how to apply VeryLooseLH
   declareProperty("TauElectronOverlapID", m_tauEleOverlapID = "Loose",
                   "Electron ID selection for tau-ele OR");
+  declareProperty("LooseElectronLabel", m_looseElectronLabel = "",
+                  "Decoration marking loose electrons for tau-ele OR");
+  declareProperty("LooseMuonLabel", m_looseMuonLabel = "",
+                  "Decoration marking loose muons for tau-mu OR");
+
+  // Event veto properties
+  declareProperty("VetoEleMuonOverlap", m_vetoEleMuonOverlap = false,
+                  "Veto events with an electron-muon shared track");
+  declareProperty("VetoNoLeptons", m_vetoNoLeptons = false,
+                  "Veto events without surviving electrons or muons "
+                  "after the lepton steps");
+  declareProperty("EventVetoLabel", m_eventVetoLabel = "",
+                  "EventInfo decoration for the veto flag; empty disables");
+
+  // Matching engine properties
+  declareProperty("FastMatching", m_fastMatching = false,
+                  "Use cached kinematics and sorted indices for matching");
+  declareProperty("ValidationMode", m_validationMode = false,
+                  "Run reference and fast matching and compare decisions");
+  declareProperty("LazyEvaluation", m_lazyEvaluation = false,
+                  "Defer the OR steps until the results are queried");
+  declareProperty("SurvivorViews", m_survivorViews = false,
+                  "Fill pT-ordered views of the surviving objects");
+
+  declareProperty("AdaptiveMatching", m_adaptiveMatching = false,
+                  "Choose brute-force or sorted-index matching per step "
+                  "from the input sizes; overrides FastMatching");
+  declareProperty("MatchingCrossover", m_matchingCrossover = -1,
+                  "Object pairs from which AdaptiveMatching uses the sorted "
+                  "index; negative calibrates it at initialize");
+
+  // Additional working points
+  declareProperty("WorkingPoints", m_workingPoints,
+                  "Extra OR working points, each given as "
+                  "\"<OverlapLabel> <Property>=<value> ...\"");
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+OverlapRemovalTool::~OverlapRemovalTool()
+{
+  if(m_valEvents > 0){
+    ATH_MSG_INFO("Validation summary: " << m_valEvents << " events, "
+                 << m_valMismatches << " mismatching decisions, "
+                 << "reference " << m_valRefTime << " s, "
+                 << "fast " << m_valFastTime << " s, speedup "
+                 << (m_valFastTime > 0 ? m_valRefTime/m_valFastTime : 0));
+  }
+  if(m_adaptiveMatching){
+    ATH_MSG_INFO("Adaptive matching summary: sorted index from "
+                 << m_crossover << " object pairs");
+    for(size_t step = 0; step < m_indexSteps.size(); ++step){
+      if(m_bruteForceSteps[step] + m_indexSteps[step] == 0) continue;
+      ATH_MSG_INFO("  " << stepName(static_cast<ORStep>(step))
+                   << ": brute force " << m_bruteForceSteps[step]
+                   << ", sorted index " << m_indexSteps[step]);
+    }
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -38,9 +159,262 @@ OverlapRemovalTool::OverlapRemovalTool(const std::string& name)
 //-----------------------------------------------------------------------------
 StatusCode OverlapRemovalTool::initialize()
 {
+  // Loose lepton labels for the tau-lep OR
+  m_looseElectronAcc.reset();
+  m_looseMuonAcc.reset();
+  if(!m_looseElectronLabel.empty()){
+    m_looseElectronAcc.reset
+      (new SG::AuxElement::ConstAccessor<int>(m_looseElectronLabel));
+  }
+  if(!m_looseMuonLabel.empty()){
+    m_looseMuonAcc.reset
+      (new SG::AuxElement::ConstAccessor<int>(m_looseMuonLabel));
+  }
+  // EventInfo decoration of the veto decision
+  m_eventVetoDec.reset();
+  if(!m_eventVetoLabel.empty()){
+    m_eventVetoDec.reset
+      (new SG::AuxElement::Decorator<int>(m_eventVetoLabel));
+  }
+  if(m_validationMode && m_lazyEvaluation){
+    ATH_MSG_ERROR("ValidationMode can't be combined with LazyEvaluation");
+    return StatusCode::FAILURE;
+  }
+  if(m_validationMode)
+    ATH_MSG_INFO("Validation mode: comparing reference and fast matching");
+
+  // The primary working point is taken from the tool properties
+  m_configs.clear();
+  m_configs.push_back(ORConfig());
+  ORConfig& primary = m_configs.back();
+  primary.overlapLabel     = m_overlapLabel;
+  primary.partnerLabel     = m_partnerLabel;
+  primary.electronJetDR    = m_electronJetDR;
+  primary.jetElectronDR    = m_jetElectronDR;
+  primary.muonJetDR        = m_muonJetDR;
+  primary.tauJetDR         = m_tauJetDR;
+  primary.tauElectronDR    = m_tauElectronDR;
+  primary.tauMuonDR        = m_tauMuonDR;
+  primary.photonElectronDR = m_photonElectronDR;
+  primary.photonMuonDR     = m_photonMuonDR;
+  primary.photonPhotonDR   = m_photonPhotonDR;
+  primary.photonJetDR      = m_photonJetDR;
+  primary.tauEleOverlapID  = m_tauEleOverlapID;
+  primary.eleMuonOverlapFound = false;
+  // Extra working points start from the primary one
+  for(const auto& spec : m_workingPoints){
+    m_configs.push_back(m_configs.front());
+    m_configs.back().partnerLabel = "";
+    ATH_CHECK( parseWorkingPoint(spec, m_configs.back()) );
+  }
+  // Each working point needs its own decorations, and an overlap flag
+  // can't share its name with a partner code
+  std::unordered_set<std::string> labels;
+  for(const auto& config : m_configs){
+    if(config.overlapLabel.empty() ||
+       !labels.insert(config.overlapLabel).second){
+      ATH_MSG_ERROR("Empty or duplicate overlap label \""
+                    << config.overlapLabel << "\"");
+      return StatusCode::FAILURE;
+    }
+    if(!config.partnerLabel.empty() &&
+       !labels.insert(config.partnerLabel).second){
+      ATH_MSG_ERROR("Duplicate partner label \"" << config.partnerLabel
+                    << "\" in working point " << config.overlapLabel);
+      return StatusCode::FAILURE;
+    }
+  }
+  for(auto& config : m_configs){
+    config.overlapDec.reset
+      (new SG::AuxElement::Decorator<int>(config.overlapLabel));
+    config.partnerDec.reset();
+    if(!config.partnerLabel.empty()){
+      config.partnerDec.reset
+        (new SG::AuxElement::Decorator<uint32_t>(config.partnerLabel));
+    }
+    ATH_MSG_DEBUG("Working point " << config.overlapLabel
+                  << ": ElectronJetDRCone " << config.electronJetDR
+                  << ", JetElectronDRCone " << config.jetElectronDR
+                  << ", MuonJetDRCone " << config.muonJetDR
+                  << ", TauElectronOverlapID " << config.tauEleOverlapID);
+  }
+  m_config = &m_configs.front();
+
+  // Matching engine crossover, calibrated with the widest cone in use
+  m_bruteForceSteps.assign(PhotonJetStep + 1, 0);
+  m_indexSteps.assign(PhotonJetStep + 1, 0);
+  if(m_adaptiveMatching){
+    m_crossover = m_matchingCrossover;
+    if(m_crossover < 0){
+      double maxDR = 0;
+      for(const auto& config : m_configs){
+        const float cones[] = {
+          config.electronJetDR, config.jetElectronDR, config.muonJetDR,
+          config.tauJetDR, config.tauElectronDR, config.tauMuonDR,
+          config.photonElectronDR, config.photonMuonDR,
+          config.photonPhotonDR, config.photonJetDR };
+        for(float cone : cones) maxDR = std::max<double>(maxDR, cone);
+      }
+      m_crossover = calibrateCrossover(maxDR);
+      ATH_MSG_INFO("Calibrated matching crossover: " << m_crossover
+                   << " object pairs; set MatchingCrossover to reuse it");
+    }
+  }
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Make sure the working points are set up before processing
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::checkInitialized()
+{
+  if(!m_config){
+    ATH_MSG_ERROR("The tool must be initialized before use");
+    return StatusCode::FAILURE;
+  }
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Calibrate the matching crossover. objectOverlaps is timed with the
+// brute-force loop and with the sorted index, matching n synthetic jets to
+// n others for growing n. Like in runSequence both engines take distances
+// from the memo, and the cache is cleared before every repetition, so the
+// index is rebuilt as in a real event. The crossover is the smallest pair
+// count from which the index wins at every larger size.
+//-----------------------------------------------------------------------------
+double OverlapRemovalTool::calibrateCrossover(double dR)
+{
+  typedef std::chrono::steady_clock Clock;
+  typedef std::chrono::duration<double> Seconds;
+
+  // Fixed seed, so the calibration only depends on the machine
+  const size_t maxSize = 256;
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<double> ptDist(5e3, 200e3);
+  std::uniform_real_distribution<double> etaDist(-2.5, 2.5);
+  std::uniform_real_distribution<double> phiDist(-M_PI, M_PI);
+  std::uniform_real_distribution<double> mDist(0, 20e3);
+
+  // The synthetic jets must pass the input selection
+  std::unique_ptr<SG::AuxElement::Decorator<int> > inputDec;
+  if(!m_inputLabel.empty())
+    inputDec.reset(new SG::AuxElement::Decorator<int>(m_inputLabel));
+  auto addJets = [&](xAOD::JetContainer& jets, size_t n){
+    for(size_t i = 0; i < n; ++i){
+      xAOD::Jet* jet = new xAOD::Jet();
+      jets.push_back(jet);
+      jet->setJetP4(xAOD::JetFourMom_t(ptDist(rng), etaDist(rng),
+                                       phiDist(rng), mDist(rng)));
+      if(inputDec) (*inputDec)(*jet) = 1;
+    }
+  };
+  xAOD::JetContainer probes;
+  xAOD::JetAuxContainer probesAux;
+  probes.setStore(&probesAux);
+  addJets(probes, maxSize);
+  xAOD::JetContainer partners;
+  xAOD::JetAuxContainer partnersAux;
+  partners.setStore(&partnersAux);
+
+  unsigned long found = 0;
+  double crossover = std::numeric_limits<double>::max();
+  m_useDistanceCache = true;
+  for(size_t n = 1; n <= maxSize; n *= 2){
+    const size_t nReps = std::max<size_t>(1, 200000/(n*n));
+    partners.clear();
+    addJets(partners, n);
+
+    double times[2];
+    for(int fast = 0; fast < 2; ++fast){
+      m_useFastMatching = fast;
+      const Clock::time_point start = Clock::now();
+      for(size_t rep = 0; rep < nReps; ++rep){
+        m_cache.clear();
+        for(size_t i = 0; i < n; ++i)
+          if(objectOverlaps(probes[i], &partners, dR) != noOverlap) ++found;
+      }
+      times[fast] = Seconds(Clock::now() - start).count();
+    }
+    const double bruteTime = times[0];
+    const double indexTime = times[1];
+
+    ATH_MSG_DEBUG("Matching calibration " << n << "x" << n << ": brute force "
+                  << bruteTime/nReps << " s, sorted index "
+                  << indexTime/nReps << " s");
+    if(indexTime >= bruteTime) crossover = std::numeric_limits<double>::max();
+    else if(crossover == std::numeric_limits<double>::max())
+      crossover = n*n;
+  }
+  m_useFastMatching = false;
+  m_useDistanceCache = false;
+  m_cache.clear();
+  ATH_MSG_VERBOSE("Matching calibration found " << found << " overlaps");
+  return crossover;
+}
+
+//-----------------------------------------------------------------------------
+// Parse a working point given as "<OverlapLabel> <Property>=<value> ...".
+// The properties are the cone properties, TauElectronOverlapID and
+// PartnerLabel.
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::parseWorkingPoint(const std::string& spec,
+                                                 ORConfig& config)
+{
+  std::istringstream stream(spec);
+  if(!(stream >> config.overlapLabel)){
+    ATH_MSG_ERROR("Empty working point specification");
+    return StatusCode::FAILURE;
+  }
+  std::string setting;
+  while(stream >> setting){
+    const size_t eq = setting.find('=');
+    const std::string key = setting.substr(0, eq);
+    const std::string value =
+      eq == std::string::npos ? "" : setting.substr(eq + 1);
+    float* cone = coneByName(config, key);
+    if(key == "TauElectronOverlapID" && !value.empty())
+      config.tauEleOverlapID = value;
+    else if(key == "PartnerLabel" && !value.empty())
+      config.partnerLabel = value;
+    else if(cone && !value.empty()){
+      // The whole value must be a non-negative number
+      char* end = 0;
+      const double dR = std::strtod(value.c_str(), &end);
+      if(*end != '\0' || !(dR >= 0)){
+        ATH_MSG_ERROR("Invalid cone \"" << setting << "\" in working point "
+                      << config.overlapLabel);
+        return StatusCode::FAILURE;
+      }
+      *cone = dR;
+    }
+    else{
+      ATH_MSG_ERROR("Invalid setting \"" << setting << "\" in working point "
+                    << config.overlapLabel);
+      return StatusCode::FAILURE;
+    }
+  }
   return StatusCode::SUCCESS;
 }
 
+//-----------------------------------------------------------------------------
+// Find a working point cone by its property name
+//-----------------------------------------------------------------------------
+float* OverlapRemovalTool::coneByName(ORConfig& config, const std::string& name)
+{
+  if(name == "ElectronJetDRCone")    return &config.electronJetDR;
+  if(name == "JetElectronDRCone")    return &config.jetElectronDR;
+  if(name == "MuonJetDRCone")        return &config.muonJetDR;
+  if(name == "TauJetDRCone")         return &config.tauJetDR;
+  if(name == "TauElectronDRCone")    return &config.tauElectronDR;
+  if(name == "TauMuonDRCone")        return &config.tauMuonDR;
+  if(name == "PhotonElectronDRCone") return &config.photonElectronDR;
+  if(name == "PhotonMuonDRCone")     return &config.photonMuonDR;
+  if(name == "PhotonPhotonDRCone")   return &config.photonPhotonDR;
+  if(name == "PhotonJetDRCone")      return &config.photonJetDR;
+  return 0;
+}
+
 //-----------------------------------------------------------------------------
 // Remove all overlapping objects according to the official
 // harmonization prescription
@@ -64,6 +438,456 @@ removeOverlaps(const xAOD::ElectronContainer* electrons,
                const xAOD::ElectronContainer* looseElectrons,
                const xAOD::MuonContainer* looseMuons,
                const xAOD::PhotonContainer* photons)
+{
+  ATH_CHECK( checkInitialized() );
+  ORInputs inputs = { electrons, muons, jets, taus,
+                      looseElectrons, looseMuons, photons };
+  m_inputs = inputs;
+  buildSequence(m_inputs, m_sequence);
+  m_nStepsDone = 0;
+
+  // The kinematics cache is only valid within one event
+  m_cache.clear();
+  m_config = &m_configs.front();
+  for(auto& config : m_configs) config.eleMuonOverlapFound = false;
+  m_eventVetoed = false;
+  m_viewsFilled = false;
+
+  if(m_validationMode){
+    ATH_CHECK( validateSequence(m_inputs, m_sequence) );
+    m_nStepsDone = m_sequence.size();
+    return decorateEventVeto();
+  }
+  // In lazy mode the steps are only run when the results are queried
+  if(m_lazyEvaluation) return StatusCode::SUCCESS;
+  return runSequence(m_sequence.size());
+}
+
+//-----------------------------------------------------------------------------
+// Check if an object overlaps, evaluating the needed steps in lazy mode
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::isOverlapping(const xAOD::IParticle* obj,
+                                             bool& overlaps)
+{
+  bool decided = false;
+  ATH_CHECK( decideObject(obj, decided, overlaps) );
+  if(decided) return StatusCode::SUCCESS;
+  ATH_CHECK( evaluateObjectType(obj->type()) );
+  overlaps = isRejectedObject(obj);
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Get the first surviving objects of a type, in container order
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::
+getSurvivingObjects(xAOD::Type::ObjectType type, size_t n,
+                    std::vector<const xAOD::IParticle*>& survivors)
+{
+  ATH_CHECK( evaluateObjectType(type) );
+  survivors.clear();
+  switch(type){
+    case xAOD::Type::Electron:
+      collectSurvivors(m_inputs.electrons, n, survivors); break;
+    case xAOD::Type::Muon:
+      collectSurvivors(m_inputs.muons, n, survivors); break;
+    case xAOD::Type::Jet:
+      collectSurvivors(m_inputs.jets, n, survivors); break;
+    case xAOD::Type::Tau:
+      collectSurvivors(m_inputs.taus, n, survivors); break;
+    case xAOD::Type::Photon:
+      collectSurvivors(m_inputs.photons, n, survivors); break;
+    default:
+      ATH_MSG_ERROR("No OR input of object type " << type);
+      return StatusCode::FAILURE;
+  }
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Get the survivor views, running the rest of the sequence in lazy mode
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::
+getSurvivorViews(const OverlapSurvivorViews*& views)
+{
+  ATH_CHECK( checkInitialized() );
+  views = 0;
+  if(!m_survivorViews){
+    ATH_MSG_ERROR("Survivor views requested without the SurvivorViews "
+                  "property");
+    return StatusCode::FAILURE;
+  }
+  ATH_CHECK( runSequence(m_sequence.size()) );
+  // Filled on the first request of the event, so events which never ask
+  // for the views don't pay for them
+  if(!m_viewsFilled) fillSurvivorViews();
+  views = &m_views;
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Fill the survivor views. The decisions of a vetoed event are incomplete,
+// so its views are left empty.
+//-----------------------------------------------------------------------------
+void OverlapRemovalTool::fillSurvivorViews()
+{
+  const bool keep = !m_eventVetoed;
+  fillSurvivorView(keep ? m_inputs.electrons : 0, m_views.electrons);
+  fillSurvivorView(keep ? m_inputs.muons : 0, m_views.muons);
+  fillSurvivorView(keep ? m_inputs.jets : 0, m_views.jets);
+  fillSurvivorView(keep ? m_inputs.taus : 0, m_views.taus);
+  fillSurvivorView(keep ? m_inputs.photons : 0, m_views.photons);
+  m_viewsFilled = true;
+}
+
+//-----------------------------------------------------------------------------
+// Find the closest surviving object of a type.
+// The sorted index is scanned outwards from the rapidity of the object;
+// each direction stops once the rapidity gap alone exceeds the best dR.
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::
+findNearestSurvivor(const xAOD::IParticle* obj, xAOD::Type::ObjectType type,
+                    const xAOD::IParticle*& nearest, double& dR)
+{
+  nearest = 0;
+  dR = -1;
+  const OverlapEventCache::SortedIndex* index = 0;
+  ATH_CHECK( evaluateObjectType(type) );
+  ATH_CHECK( inputIndex(type, index) );
+  if(!index) return StatusCode::SUCCESS;
+
+  const double y = m_cache.kinematics(obj).rapidity;
+  double bestDR2 = std::numeric_limits<double>::infinity();
+  auto consider = [&](const xAOD::IParticle* other){
+    if(other == obj || !isSurvivingObject(other)) return;
+    const double dR2 = m_cache.deltaR2(obj, other);
+    if(dR2 < bestDR2){
+      bestDR2 = dR2;
+      nearest = other;
+    }
+  };
+  const auto start = OverlapEventCache::lowerBound(*index, y);
+  for(auto entry = start; entry != index->end(); ++entry){
+    const double dY = entry->rapidity - y;
+    if(dY*dY >= bestDR2) break;
+    consider(entry->obj);
+  }
+  for(auto entry = start; entry != index->begin(); ){
+    --entry;
+    const double dY = entry->rapidity - y;
+    if(dY*dY >= bestDR2) break;
+    consider(entry->obj);
+  }
+  if(nearest) dR = sqrt(bestDR2);
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Find the surviving objects of a type inside a dR cone
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::
+findSurvivorsInCone(const xAOD::IParticle* obj, xAOD::Type::ObjectType type,
+                    double dRMax, std::vector<const xAOD::IParticle*>& found)
+{
+  if(dRMax < 0){
+    ATH_MSG_ERROR("Negative cone size " << dRMax << " in findSurvivorsInCone");
+    return StatusCode::FAILURE;
+  }
+  found.clear();
+  const OverlapEventCache::SortedIndex* index = 0;
+  ATH_CHECK( evaluateObjectType(type) );
+  ATH_CHECK( inputIndex(type, index) );
+  if(!index) return StatusCode::SUCCESS;
+
+  OverlapEventCache::IndexRange range =
+    OverlapEventCache::window(*index, m_cache.kinematics(obj).rapidity, dRMax);
+  for(auto entry = range.first; entry != range.second; ++entry){
+    const xAOD::IParticle* other = entry->obj;
+    if(other == obj || !isSurvivingObject(other)) continue;
+    if(m_cache.deltaR2(obj, other) < dRMax*dRMax) found.push_back(other);
+  }
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Get the sorted index of an input container
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::
+inputIndex(xAOD::Type::ObjectType type,
+           const OverlapEventCache::SortedIndex*& index)
+{
+  index = 0;
+  switch(type){
+    case xAOD::Type::Electron:
+      if(m_inputs.electrons) index = &m_cache.sortedIndex(m_inputs.electrons);
+      break;
+    case xAOD::Type::Muon:
+      if(m_inputs.muons) index = &m_cache.sortedIndex(m_inputs.muons);
+      break;
+    case xAOD::Type::Jet:
+      if(m_inputs.jets) index = &m_cache.sortedIndex(m_inputs.jets);
+      break;
+    case xAOD::Type::Tau:
+      if(m_inputs.taus) index = &m_cache.sortedIndex(m_inputs.taus);
+      break;
+    case xAOD::Type::Photon:
+      if(m_inputs.photons) index = &m_cache.sortedIndex(m_inputs.photons);
+      break;
+    default:
+      ATH_MSG_ERROR("No OR input of object type " << type);
+      return StatusCode::FAILURE;
+  }
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Run the steps needed to decide all objects of a type.
+// Later steps don't change the decisions of that type, so the result is
+// identical to running the full sequence.
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::evaluateObjectType(xAOD::Type::ObjectType type)
+{
+  ATH_CHECK( checkInitialized() );
+  size_t nSteps = 0;
+  for(size_t i = 0; i < m_sequence.size(); ++i)
+    if(stepDecides(m_sequence[i], type)) nSteps = i + 1;
+  return runSequence(nSteps);
+}
+
+//-----------------------------------------------------------------------------
+// Decide a single electron, tau or photon in lazy mode, without running the
+// pending steps or writing any decoration. The pending steps are replayed
+// for this object alone, against the partners which survive the steps
+// before them, so the result is that of the full sequence for the primary
+// working point. Muons and jets depend on the decisions of whole
+// containers and, like a configured veto, fall back to evaluateObjectType.
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::decideObject(const xAOD::IParticle* obj,
+                                            bool& decided, bool& overlaps)
+{
+  ATH_CHECK( checkInitialized() );
+  decided = false;
+  if(!m_lazyEvaluation || m_eventVetoed ||
+     m_vetoEleMuonOverlap || m_vetoNoLeptons) return StatusCode::SUCCESS;
+
+  const xAOD::Type::ObjectType type = obj->type();
+  if(type != xAOD::Type::Electron && type != xAOD::Type::Tau &&
+     type != xAOD::Type::Photon) return StatusCode::SUCCESS;
+  bool pending = false;
+  for(size_t i = m_nStepsDone; i < m_sequence.size(); ++i)
+    if(stepDecides(m_sequence[i], type)) pending = true;
+  if(!pending) return StatusCode::SUCCESS;
+
+  decided = true;
+  overlaps = isRejectedObject(obj);
+  if(!isSurvivingObject(obj)) return StatusCode::SUCCESS;
+
+  m_useDistanceCache = true;
+  StatusCode sc = StatusCode::SUCCESS;
+  if(type == xAOD::Type::Electron){
+    if(inContainer(m_inputs.electrons, obj)){
+      const auto electron = static_cast<const xAOD::Electron*>(obj);
+      overlaps = !survivesEleMuon(electron);
+      if(!overlaps && stepPending(EleJetStep)){
+        for(const auto jet : *m_inputs.jets){
+          if(survivesEleJet(jet) &&
+             objectsOverlap(electron, jet, m_config->jetElectronDR)){
+            overlaps = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+  else if(type == xAOD::Type::Tau){
+    if(inContainer(m_inputs.taus, obj)){
+      if(stepPending(TauEleStep)){
+        for(const auto electron : *m_inputs.looseElectrons){
+          if(!isSurvivingLooseLepton(electron, m_looseElectronAcc.get()))
+            continue;
+          bool passID = false;
+          if(!electron->passSelection(passID, m_config->tauEleOverlapID)){
+            ATH_MSG_ERROR("Electron ID for tau-ele OR not available: "
+                          << m_config->tauEleOverlapID);
+            sc = StatusCode::FAILURE;
+            break;
+          }
+          if(passID && objectsOverlap(obj, electron, m_config->tauElectronDR)){
+            overlaps = true;
+            break;
+          }
+        }
+      }
+      if(!overlaps && sc.isSuccess() && stepPending(TauMuonStep)){
+        for(const auto muon : *m_inputs.looseMuons){
+          if(isSurvivingLooseLepton(muon, m_looseMuonAcc.get()) &&
+             objectsOverlap(obj, muon, m_config->tauMuonDR)){
+            overlaps = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+  else if(inContainer(m_inputs.photons, obj)){
+    if(stepPending(PhotonEleStep)){
+      for(const auto electron : *m_inputs.electrons){
+        if(survivesEleMuon(electron) &&
+           objectsOverlap(obj, electron, m_config->photonElectronDR)){
+          overlaps = true;
+          break;
+        }
+      }
+    }
+    if(!overlaps && stepPending(PhotonMuonStep)){
+      for(const auto muon : *m_inputs.muons){
+        if(isSurvivingObject(muon) &&
+           objectsOverlap(obj, muon, m_config->photonMuonDR)){
+          overlaps = true;
+          break;
+        }
+      }
+    }
+  }
+  m_useDistanceCache = false;
+  return sc;
+}
+
+//-----------------------------------------------------------------------------
+// Check if a step of the current event is still to be run
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::stepPending(ORStep step)
+{
+  for(size_t i = m_nStepsDone; i < m_sequence.size(); ++i)
+    if(m_sequence[i] == step) return true;
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Check if an electron survives the ele-mu step, replaying it if pending
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::survivesEleMuon(const xAOD::Electron* electron)
+{
+  if(!isSurvivingObject(electron)) return false;
+  if(!stepPending(EleMuonStep)) return true;
+  const xAOD::TrackParticle* elTrk = electron->trackParticle();
+  if(!elTrk) return true;
+  for(const auto muon : *m_inputs.muons){
+    if(isSurvivingObject(muon) &&
+       muon->trackParticle(xAOD::Muon::InnerDetectorTrackParticle) == elTrk)
+      return false;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Check if a jet survives the jet removal of the ele-jet step,
+// replaying it if pending
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::survivesEleJet(const xAOD::Jet* jet)
+{
+  if(!isSurvivingObject(jet)) return false;
+  if(!stepPending(EleJetStep)) return true;
+  for(const auto electron : *m_inputs.electrons){
+    if(survivesEleMuon(electron) &&
+       objectsOverlap(jet, electron, m_config->electronJetDR)) return false;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Run the sequence up to (excluding) step nSteps, resuming after the steps
+// which are already done. Stops early if the event is vetoed.
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::runSequence(size_t nSteps)
+{
+  if(m_eventVetoed || m_nStepsDone >= nSteps) return StatusCode::SUCCESS;
+
+  // Make sure the engine is reset even if a step fails,
+  // so direct calls to the individual methods use the reference loops.
+  StatusCode sc = StatusCode::SUCCESS;
+  while(m_nStepsDone < nSteps && !m_eventVetoed && sc.isSuccess()){
+    const size_t i = m_nStepsDone;
+    m_useFastMatching = chooseFastMatching(m_sequence[i], m_inputs);
+    // Every step takes its distances from the memo, whichever engine runs,
+    // so each pair is computed once per event across steps and working
+    // points. Only the reference pass of ValidationMode and direct calls
+    // of the individual methods compute them from scratch.
+    m_useDistanceCache = true;
+    for(auto& config : m_configs){
+      m_config = &config;
+      sc = runStep(m_sequence[i], m_inputs);
+      if(sc.isFailure()) break;
+    }
+    m_config = &m_configs.front();
+    if(sc.isFailure()) break;
+    ++m_nStepsDone;
+    m_eventVetoed = checkEventVeto(m_inputs, m_sequence, i);
+  }
+  m_useFastMatching = false;
+  m_useDistanceCache = false;
+  ATH_CHECK( sc );
+
+  // The veto decision is final once the sequence is done or vetoed
+  if(m_eventVetoed || m_nStepsDone == m_sequence.size())
+    ATH_CHECK( decorateEventVeto() );
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Choose the matching engine of a step. Without AdaptiveMatching all steps
+// follow the FastMatching property. With it, only the steps which can use
+// the sorted index are decided and counted; the others always run their
+// own loops.
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::chooseFastMatching(ORStep step,
+                                            const ORInputs& inputs)
+{
+  if(!m_adaptiveMatching) return m_fastMatching;
+  if(!stepUsesIndex(step)) return false;
+  if(stepPairs(step, inputs) >= m_crossover){
+    ++m_indexSteps[step];
+    return true;
+  }
+  ++m_bruteForceSteps[step];
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Check if a step matches through objectOverlaps, and so can use the index.
+// The tau-lep and mu-jet steps run their own nested loops, and the ele-mu
+// step only compares tracks.
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::stepUsesIndex(ORStep step)
+{
+  return step == EleJetStep || step == PhotonEleStep ||
+         step == PhotonMuonStep || step == PhotonJetStep;
+}
+
+//-----------------------------------------------------------------------------
+// Count the object pairs compared through objectOverlaps by a step
+//-----------------------------------------------------------------------------
+double OverlapRemovalTool::stepPairs(ORStep step, const ORInputs& inputs)
+{
+  switch(step){
+    case PhotonEleStep:
+      return inputSize(inputs.photons) * inputSize(inputs.electrons);
+    case PhotonMuonStep:
+      return inputSize(inputs.photons) * inputSize(inputs.muons);
+    case EleJetStep:
+      return inputSize(inputs.electrons) * inputSize(inputs.jets);
+    case PhotonJetStep:
+      return inputSize(inputs.photons) * inputSize(inputs.jets);
+    default:
+      return 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Build the recommended sequence of OR steps
+//-----------------------------------------------------------------------------
+void OverlapRemovalTool::buildSequence(const ORInputs& inputs,
+                                       std::vector<ORStep>& steps)
 {
   /*
     Recommended removal sequence
@@ -75,24 +899,247 @@ removeOverlaps(const xAOD::ElectronContainer* electrons,
     5. lep/photon - jet OR
   */
 
+  steps.clear();
   // Tau and loose ele/mu OR
-  if(taus){
-    ATH_CHECK( removeTauEleOverlap(taus, looseElectrons) );
-    ATH_CHECK( removeTauMuonOverlap(taus, looseMuons) );
+  if(inputs.taus){
+    steps.push_back(TauEleStep);
+    steps.push_back(TauMuonStep);
   }
   // e-mu OR
-  ATH_CHECK( removeEleMuonOverlap(electrons, muons) );
+  steps.push_back(EleMuonStep);
   // photon and e/mu OR
-  if(photons){
+  if(inputs.photons){
     // TODO: find out where pho-pho OR fits in
-    //ATH_CHECK( removePhotonPhotonOverlap(photons) );
-    ATH_CHECK( removePhotonEleOverlap(photons, electrons) );
-    ATH_CHECK( removePhotonMuonOverlap(photons, muons) );
+    steps.push_back(PhotonEleStep);
+    steps.push_back(PhotonMuonStep);
   }
   // lep/photon and jet OR
-  ATH_CHECK( removeEleJetOverlap(electrons, jets) );
-  ATH_CHECK( removeMuonJetOverlap(muons, jets) );
-  if(photons) ATH_CHECK( removePhotonJetOverlap(photons, jets) );
+  steps.push_back(EleJetStep);
+  steps.push_back(MuonJetStep);
+  if(inputs.photons) steps.push_back(PhotonJetStep);
+}
+
+//-----------------------------------------------------------------------------
+// Run one step of the sequence
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::runStep(ORStep step, const ORInputs& inputs)
+{
+  switch(step){
+    case TauEleStep:
+      return removeTauEleOverlap(inputs.taus, inputs.looseElectrons);
+    case TauMuonStep:
+      return removeTauMuonOverlap(inputs.taus, inputs.looseMuons);
+    case EleMuonStep:
+      return removeEleMuonOverlap(inputs.electrons, inputs.muons);
+    case PhotonEleStep:
+      return removePhotonEleOverlap(inputs.photons, inputs.electrons);
+    case PhotonMuonStep:
+      return removePhotonMuonOverlap(inputs.photons, inputs.muons);
+    case EleJetStep:
+      return removeEleJetOverlap(inputs.electrons, inputs.jets);
+    case MuonJetStep:
+      return removeMuonJetOverlap(inputs.muons, inputs.jets);
+    case PhotonJetStep:
+      return removePhotonJetOverlap(inputs.photons, inputs.jets);
+  }
+  ATH_MSG_ERROR("Unknown OR step " << step);
+  return StatusCode::FAILURE;
+}
+
+//-----------------------------------------------------------------------------
+// Check if a step can change the decisions of an object type
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::stepDecides(ORStep step, xAOD::Type::ObjectType type)
+{
+  switch(step){
+    case TauEleStep:
+    case TauMuonStep:
+      return type == xAOD::Type::Tau;
+    case EleMuonStep:
+      return type == xAOD::Type::Electron;
+    case PhotonEleStep:
+    case PhotonMuonStep:
+      return type == xAOD::Type::Photon;
+    case EleJetStep:
+      return type == xAOD::Type::Jet || type == xAOD::Type::Electron;
+    case MuonJetStep:
+      return type == xAOD::Type::Jet || type == xAOD::Type::Muon;
+    case PhotonJetStep:
+      return type == xAOD::Type::Jet;
+  }
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Readable step names
+//-----------------------------------------------------------------------------
+const char* OverlapRemovalTool::stepName(ORStep step)
+{
+  switch(step){
+    case TauEleStep: return "TauEle";
+    case TauMuonStep: return "TauMuon";
+    case EleMuonStep: return "EleMuon";
+    case PhotonEleStep: return "PhotonEle";
+    case PhotonMuonStep: return "PhotonMuon";
+    case EleJetStep: return "EleJet";
+    case MuonJetStep: return "MuonJet";
+    case PhotonJetStep: return "PhotonJet";
+  }
+  return "Unknown";
+}
+
+//-----------------------------------------------------------------------------
+// Check the event veto conditions after a step.
+// The veto is decided by the primary working point.
+// The lepton requirement is checked once the last lepton step is done,
+// so the expensive jet steps can be skipped.
+//-----------------------------------------------------------------------------
+bool OverlapRemovalTool::checkEventVeto(const ORInputs& inputs,
+                                        const std::vector<ORStep>& steps,
+                                        size_t i)
+{
+  const ORStep step = steps[i];
+  if(m_vetoEleMuonOverlap && step == EleMuonStep &&
+     m_config->eleMuonOverlapFound){
+    ATH_MSG_DEBUG("Event vetoed by electron-muon shared track");
+    return true;
+  }
+  const bool leptonStepsDone = !isJetStep(step) &&
+    (i + 1 == steps.size() || isJetStep(steps[i + 1]));
+  if(m_vetoNoLeptons && leptonStepsDone &&
+     !hasSurvivingObject(inputs.electrons) &&
+     !hasSurvivingObject(inputs.muons)){
+    ATH_MSG_DEBUG("Event vetoed: no surviving leptons");
+    return true;
+  }
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Decorate the EventInfo with the veto decision
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::decorateEventVeto()
+{
+  if(!m_eventVetoDec) return StatusCode::SUCCESS;
+  const xAOD::EventInfo* evtInfo = 0;
+  ATH_CHECK( evtStore()->retrieve(evtInfo, "EventInfo") );
+  (*m_eventVetoDec)(*evtInfo) = m_eventVetoed;
+  return StatusCode::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Validate the fast matching engine against the reference loops.
+// Each step is run by both engines from the same starting decisions,
+// so every reported mismatch is caused by the step it is reported for.
+// The reference decisions are left on the objects.
+//-----------------------------------------------------------------------------
+StatusCode OverlapRemovalTool::validateSequence(const ORInputs& inputs,
+                                                const std::vector<ORStep>& steps)
+{
+  typedef std::chrono::steady_clock Clock;
+  typedef std::chrono::duration<double> Seconds;
+
+  // Collect each input object once
+  std::unordered_set<const xAOD::IParticle*> seen;
+  m_valObjects.clear();
+  collectObjects(inputs.electrons, m_valObjects, seen);
+  collectObjects(inputs.muons, m_valObjects, seen);
+  collectObjects(inputs.jets, m_valObjects, seen);
+  collectObjects(inputs.taus, m_valObjects, seen);
+  collectObjects(inputs.looseElectrons, m_valObjects, seen);
+  collectObjects(inputs.looseMuons, m_valObjects, seen);
+  collectObjects(inputs.photons, m_valObjects, seen);
+
+  // Decisions are kept per working point, one block of objects each
+  const size_t nObj = m_valObjects.size();
+  const size_t nConfigs = m_configs.size();
+  m_valBefore.resize(nObj*nConfigs);
+  m_valRef.resize(nObj*nConfigs);
+  m_valPartnerBefore.resize(nObj*nConfigs);
+  m_valPartnerRef.resize(nObj*nConfigs);
+  for(size_t c = 0; c < nConfigs; ++c){
+    m_config = &m_configs[c];
+    for(size_t i = 0; i < nObj; ++i){
+      m_valBefore[c*nObj + i] = getOverlapDecoration(m_valObjects[i]);
+      m_valPartnerBefore[c*nObj + i] = getPartnerDecoration(m_valObjects[i]);
+    }
+  }
+
+  double refTime = 0, fastTime = 0;
+  unsigned long mismatches = 0;
+  for(size_t iStep = 0; iStep < steps.size() && !m_eventVetoed; ++iStep){
+    const ORStep step = steps[iStep];
+
+    for(size_t c = 0; c < nConfigs; ++c){
+      m_config = &m_configs[c];
+      int* before = &m_valBefore[c*nObj];
+      int* ref = &m_valRef[c*nObj];
+      uint32_t* partnerBefore = &m_valPartnerBefore[c*nObj];
+      uint32_t* partnerRef = &m_valPartnerRef[c*nObj];
+
+      // Reference engine
+      m_useFastMatching = false;
+      Clock::time_point start = Clock::now();
+      StatusCode sc = runStep(step, inputs);
+      refTime += Seconds(Clock::now() - start).count();
+      ATH_CHECK( sc );
+      for(size_t i = 0; i < nObj; ++i){
+        ref[i] = getOverlapDecoration(m_valObjects[i]);
+        partnerRef[i] = getPartnerDecoration(m_valObjects[i]);
+      }
+
+      // Fast engine, starting from the same decisions
+      for(size_t i = 0; i < nObj; ++i)
+        setOverlapDecoration(m_valObjects[i], before[i], partnerBefore[i]);
+      m_useFastMatching = true;
+      m_useDistanceCache = true;
+      start = Clock::now();
+      sc = runStep(step, inputs);
+      fastTime += Seconds(Clock::now() - start).count();
+      m_useFastMatching = false;
+      m_useDistanceCache = false;
+      ATH_CHECK( sc );
+
+      // Compare, then continue from the reference decisions
+      for(size_t i = 0; i < nObj; ++i){
+        const xAOD::IParticle* obj = m_valObjects[i];
+        const int fastDecision = getOverlapDecoration(obj);
+        const uint32_t fastPartner = getPartnerDecoration(obj);
+        if(fastDecision != ref[i] || fastPartner != partnerRef[i]){
+          ++mismatches;
+          ATH_MSG_WARNING("Validation mismatch in step " << stepName(step)
+                          << " of " << m_config->overlapLabel << ": "
+                          << typeName(obj) << " " << obj->index()
+                          << " pt " << obj->pt()/1000. << " eta " << obj->eta()
+                          << " phi " << obj->phi() << " y " << obj->rapidity()
+                          << " reference " << ref[i]
+                          << " (partner " << partnerRef[i] << ")"
+                          << " fast " << fastDecision
+                          << " (partner " << fastPartner << ")");
+        }
+        setOverlapDecoration(obj, ref[i], partnerRef[i]);
+        before[i] = ref[i];
+        partnerBefore[i] = partnerRef[i];
+      }
+    }
+    m_config = &m_configs.front();
+    m_eventVetoed = checkEventVeto(inputs, steps, iStep);
+  }
+
+  ++m_valEvents;
+  m_valMismatches += mismatches;
+  m_valRefTime += refTime;
+  m_valFastTime += fastTime;
+  const double speedup = fastTime > 0 ? refTime/fastTime : 0;
+  if(mismatches > 0){
+    ATH_MSG_WARNING("Validation found " << mismatches << " mismatching "
+                    << "decisions; reference " << refTime << " s, fast "
+                    << fastTime << " s, speedup " << speedup);
+  }
+  else{
+    ATH_MSG_DEBUG("Validation OK; reference " << refTime << " s, fast "
+                  << fastTime << " s, speedup " << speedup);
+  }
   return StatusCode::SUCCESS;
 }
 
@@ -103,13 +1150,16 @@ removeOverlaps(const xAOD::ElectronContainer* electrons,
 StatusCode OverlapRemovalTool::removeEleJetOverlap
 (const xAOD::ElectronContainer* electrons, const xAOD::JetContainer* jets)
 {
+  ATH_CHECK( checkInitialized() );
   // Remove jets that overlap with electrons in dR < 0.2
   for(const auto jet : *jets){
     // Check that this jet passes the input selection
     if(isSurvivingObject(jet)){
       // Use the generic OR method
-      if(objectOverlaps<xAOD::ElectronContainer>(jet, electrons, m_electronJetDR))
-        setObjectFail(jet);
+      const size_t partner = objectOverlaps<xAOD::ElectronContainer>
+        (jet, electrons, m_config->electronJetDR);
+      if(partner != noOverlap)
+        setObjectFail(jet, encodePartner(ElectronInput, partner));
       else setObjectPass(jet);
     }
   }
@@ -119,8 +1169,10 @@ StatusCode OverlapRemovalTool::removeEleJetOverlap
     // Check that this electron passes the input selection
     if(isSurvivingObject(electron)){
       // Use the generic OR method
-      if(objectOverlaps<xAOD::JetContainer>(electron, jets, m_jetElectronDR))
-        setObjectFail(electron);
+      const size_t partner = objectOverlaps<xAOD::JetContainer>
+        (electron, jets, m_config->jetElectronDR);
+      if(partner != noOverlap)
+        setObjectFail(electron, encodePartner(JetInput, partner));
       else setObjectPass(electron);
     }
   }
@@ -135,25 +1187,29 @@ StatusCode OverlapRemovalTool::removeEleJetOverlap
 StatusCode OverlapRemovalTool::removeMuonJetOverlap
 (const xAOD::MuonContainer* muons, const xAOD::JetContainer* jets)
 {
+  ATH_CHECK( checkInitialized() );
   // Accessor to jet.nTrack
   // Is there any faster way to access this information?
   std::vector<int> nTrkVec;
   //static SG::AuxElement::ConstAccessor<int> nTrkAcc("NumTrkPt1000");
 
   // Loop over jets
-  for(const auto jet : *jets){
+  for(size_t iJet = 0; iJet < jets->size(); ++iJet){
+    const xAOD::Jet* jet = (*jets)[iJet];
     if(isSurvivingObject(jet)){
       //int nTrk = nTrkAcc(*jet);
       jet->getAttribute(xAOD::JetAttribute::NumTrkPt500, nTrkVec);
       int nTrk = nTrkVec[0];
       // Loop over muons
-      for(const auto muon : *muons){
+      for(size_t iMuon = 0; iMuon < muons->size(); ++iMuon){
+        const xAOD::Muon* muon = (*muons)[iMuon];
         // Check for overlap
         if(isSurvivingObject(muon)){
-          if(objectsOverlap(jet, muon, m_muonJetDR)){
+          if(objectsOverlap(jet, muon, m_config->muonJetDR)){
             bool tossMuon = nTrk > 2;
-            setOverlapDecoration(muon, tossMuon);
-            setOverlapDecoration(jet, !tossMuon);
+            setOverlapDecoration(muon, tossMuon, encodePartner(JetInput, iJet));
+            setOverlapDecoration(jet, !tossMuon,
+                                 encodePartner(MuonInput, iMuon));
             //setOutputDecoration(jet, keepJet);
             //setOutputDecoration(muon, !keepJet);
             // Move on to next jet if we're tossing it
@@ -176,24 +1232,34 @@ StatusCode OverlapRemovalTool::removeMuonJetOverlap
 StatusCode OverlapRemovalTool::removeEleMuonOverlap
 (const xAOD::ElectronContainer* electrons, const xAOD::MuonContainer* muons)
 {
+  ATH_CHECK( checkInitialized() );
   // Loop over electrons
   for(const auto electron : *electrons){
     if(isSurvivingObject(electron)){
       int eleOverlaps = 0;
+      uint32_t partner = noPartner;
       //int elePass = 1;
       const xAOD::TrackParticle* elTrk = electron->trackParticle();
+      // Electrons without a track (e.g. forward) can't share one
+      if(!elTrk){
+        setObjectPass(electron);
+        continue;
+      }
       // Loop over muons
-      for(const auto muon : *muons){
+      for(size_t iMuon = 0; iMuon < muons->size(); ++iMuon){
+        const xAOD::Muon* muon = (*muons)[iMuon];
         const xAOD::TrackParticle* muTrk =
           muon->trackParticle(xAOD::Muon::InnerDetectorTrackParticle);
         // Discard electron if they share an ID track
         if(isSurvivingObject(muon) && (elTrk == muTrk)){
           eleOverlaps = 1;
+          partner = encodePartner(MuonInput, iMuon);
+          m_config->eleMuonOverlapFound = true;
           //elePass = 0;
           break;
         }
       }
-      setOverlapDecoration(electron, eleOverlaps);
+      setOverlapDecoration(electron, eleOverlaps, partner);
       //setOutputDecoration(electron, elePass);
     }
   }
@@ -206,12 +1272,15 @@ StatusCode OverlapRemovalTool::removeEleMuonOverlap
 StatusCode OverlapRemovalTool::removeTauJetOverlap(const xAOD::TauJetContainer* taus,
                                                    const xAOD::JetContainer* jets)
 {
+  ATH_CHECK( checkInitialized() );
   // Loop over jets
   for(const auto jet : *jets){
     // Check that this jet passes the input selection
     if(isSurvivingObject(jet)){
-      if(objectOverlaps<xAOD::TauJetContainer>(jet, taus, m_tauJetDR))
-        setObjectFail(jet);
+      const size_t partner = objectOverlaps<xAOD::TauJetContainer>
+        (jet, taus, m_config->tauJetDR);
+      if(partner != noOverlap)
+        setObjectFail(jet, encodePartner(TauInput, partner));
       else setObjectPass(jet);
     }
   }
@@ -224,28 +1293,32 @@ StatusCode OverlapRemovalTool::removeTauJetOverlap(const xAOD::TauJetContainer*
 StatusCode OverlapRemovalTool::removeTauEleOverlap
 (const xAOD::TauJetContainer* taus, const xAOD::ElectronContainer* electrons)
 {
+  ATH_CHECK( checkInitialized() );
   // Remove tau if overlaps with a loose electron in dR < 0.2
   for(const auto tau : *taus){
     if(isSurvivingObject(tau)){
       int tauOverlaps = 0;
+      uint32_t partner = noPartner;
       //int tauPass = 1;
-      for(const auto electron : *electrons){
-        if(isSurvivingObject(electron)){
+      for(size_t iEle = 0; iEle < electrons->size(); ++iEle){
+        const xAOD::Electron* electron = (*electrons)[iEle];
+        if(isSurvivingLooseLepton(electron, m_looseElectronAcc.get())){
           // TODO: use faster method. This is slow.
           bool passID = false;
-          if(!electron->passSelection(passID, m_tauEleOverlapID)){
+          if(!electron->passSelection(passID, m_config->tauEleOverlapID)){
             ATH_MSG_ERROR("Electron ID for tau-ele OR not available: "
-                          << m_tauEleOverlapID);
+                          << m_config->tauEleOverlapID);
             return StatusCode::FAILURE;
           }
-          if(passID && objectsOverlap(tau, electron, m_tauElectronDR)){
+          if(passID && objectsOverlap(tau, electron, m_config->tauElectronDR)){
             tauOverlaps = 1;
+            partner = encodePartner(LooseElectronInput, iEle);
             //tauPass = 0;
             break;
           } // electron overlaps
         } // is surviving electron
       } // electron loop
-      setOverlapDecoration(tau, tauOverlaps);
+      setOverlapDecoration(tau, tauOverlaps, partner);
       //setOutputDecoration(tau, tauPass);
     } // is surviving tau
   } // tau loop
@@ -259,20 +1332,25 @@ StatusCode OverlapRemovalTool::removeTauEleOverlap
 StatusCode OverlapRemovalTool::removeTauMuonOverlap
 (const xAOD::TauJetContainer* taus, const xAOD::MuonContainer* muons)
 {
+  ATH_CHECK( checkInitialized() );
   // Remove tau if overlaps with a muon in dR < 0.2
   for(const auto tau : *taus){
     if(isSurvivingObject(tau)){
       int tauOverlaps = 0;
+      uint32_t partner = noPartner;
       //int tauPass = 1;
-      for(const auto muon : *muons){
+      for(size_t iMuon = 0; iMuon < muons->size(); ++iMuon){
+        const xAOD::Muon* muon = (*muons)[iMuon];
         // TODO: update the loose muon criteria
-        if(isSurvivingObject(muon) && objectsOverlap(tau, muon, m_tauMuonDR)){
+        if(isSurvivingLooseLepton(muon, m_looseMuonAcc.get()) &&
+           objectsOverlap(tau, muon, m_config->tauMuonDR)){
           tauOverlaps = 1;
+          partner = encodePartner(LooseMuonInput, iMuon);
           //tauPass = 0;
           break;
         } // muon overlaps
       } // muon loop
-      setOverlapDecoration(tau, tauOverlaps);
+      setOverlapDecoration(tau, tauOverlaps, partner);
       //setOutputDecoration(tau, tauPass);
     } // is surviving tau
   } // tau loop
@@ -285,12 +1363,15 @@ StatusCode OverlapRemovalTool::removeTauMuonOverlap
 StatusCode OverlapRemovalTool::removePhotonEleOverlap
 (const xAOD::PhotonContainer* photons, const xAOD::ElectronContainer* electrons)
 {
+  ATH_CHECK( checkInitialized() );
   for(const auto photon : *photons){
     if(isSurvivingObject(photon)){
       // This generic template method makes the code concise,
       // but is it now overly complicated? Need to decide.
-      if(objectOverlaps<xAOD::ElectronContainer>(photon, electrons, m_photonElectronDR))
-        setObjectFail(photon);
+      const size_t partner = objectOverlaps<xAOD::ElectronContainer>
+        (photon, electrons, m_config->photonElectronDR);
+      if(partner != noOverlap)
+        setObjectFail(photon, encodePartner(ElectronInput, partner));
       else setObjectPass(photon);
     }
   }
@@ -303,12 +1384,15 @@ StatusCode OverlapRemovalTool::removePhotonEleOverlap
 StatusCode OverlapRemovalTool::removePhotonMuonOverlap
 (const xAOD::PhotonContainer* photons, const xAOD::MuonContainer* muons)
 {
+  ATH_CHECK( checkInitialized() );
   for(const auto photon : *photons){
     if(isSurvivingObject(photon)){
       // This generic template method makes the code concise,
       // but is it now overly complicated? Need to decide.
-      if(objectOverlaps<xAOD::MuonContainer>(photon, muons, m_photonMuonDR))
-        setObjectFail(photon);
+      const size_t partner = objectOverlaps<xAOD::MuonContainer>
+        (photon, muons, m_config->photonMuonDR);
+      if(partner != noOverlap)
+        setObjectFail(photon, encodePartner(MuonInput, partner));
       else setObjectPass(photon);
     }
   }
@@ -321,13 +1405,16 @@ StatusCode OverlapRemovalTool::removePhotonMuonOverlap
 StatusCode OverlapRemovalTool::removePhotonPhotonOverlap
 (const xAOD::PhotonContainer* photons)
 {
+  ATH_CHECK( checkInitialized() );
   for(const auto photon : *photons){
     if(isSurvivingObject(photon)){
       // This generic template method makes the code concise,
       // but is it now overly complicated? Need to decide.
       // TODO: what is the correct overlap cone here?
-      if(objectOverlaps<xAOD::PhotonContainer>(photon, photons, m_photonPhotonDR))
-        setObjectFail(photon);
+      const size_t partner = objectOverlaps<xAOD::PhotonContainer>
+        (photon, photons, m_config->photonPhotonDR);
+      if(partner != noOverlap)
+        setObjectFail(photon, encodePartner(PhotonInput, partner));
       else setObjectPass(photon);
     }
   }
@@ -340,18 +1427,53 @@ StatusCode OverlapRemovalTool::removePhotonPhotonOverlap
 StatusCode OverlapRemovalTool::removePhotonJetOverlap
 (const xAOD::PhotonContainer* photons, const xAOD::JetContainer* jets)
 {
+  ATH_CHECK( checkInitialized() );
   for(const auto jet : *jets){
     if(isSurvivingObject(jet)){
       // This generic template method makes the code concise,
       // but is it now overly complicated? Need to decide.
-      if(objectOverlaps<xAOD::PhotonContainer>(jet, photons, m_photonJetDR))
-        setObjectFail(jet);
+      const size_t partner = objectOverlaps<xAOD::PhotonContainer>
+        (jet, photons, m_config->photonJetDR);
+      if(partner != noOverlap)
+        setObjectFail(jet, encodePartner(PhotonInput, partner));
       else setObjectPass(jet);
     }
   }
   return StatusCode::SUCCESS;
 }
 
+//-----------------------------------------------------------------------------
+// Fast version of the generic overlap check.
+// Only objects inside the rapidity window of the sorted index are tested.
+// The window is in rapidity order, so when the partner is recorded (or
+// compared in ValidationMode) the whole window is scanned to find the
+// overlapping object which comes first in the container, like the
+// reference loop does. Otherwise any overlap decides, and the scan stops
+// at the first one.
+//-----------------------------------------------------------------------------
+size_t OverlapRemovalTool::objectOverlapsFast
+(const xAOD::IParticle* obj, const OverlapEventCache::SortedIndex& index,
+ double dR)
+{
+  const OverlapEventCache::Kinematics kin = m_cache.kinematics(obj);
+  OverlapEventCache::IndexRange range =
+    OverlapEventCache::window(index, kin.rapidity, dR);
+  const bool needFirst = m_config->partnerDec || m_validationMode;
+  size_t first = noOverlap;
+  for(auto entry = range.first; entry != range.second; ++entry){
+    // Only an earlier object can change the result
+    if(entry->position >= first) continue;
+    const xAOD::IParticle* contObj = entry->obj;
+    // Make sure these are not the same object
+    if(isSurvivingObject(contObj) && obj != contObj &&
+       objectsOverlap(obj, contObj, dR)){
+      if(!needFirst) return entry->position;
+      first = entry->position;
+    }
+  }
+  return first;
+}
+
 //-----------------------------------------------------------------------------
 // Check if two objects overlap in a dR window
 //-----------------------------------------------------------------------------
@@ -359,7 +1481,7 @@ bool OverlapRemovalTool::objectsOverlap(const xAOD::IParticle* p1,
                                         const xAOD::IParticle* p2,
                                         double dRMax, double dRMin)
 {
-  double dR2 = deltaR2(p1, p2);
+  double dR2 = m_useDistanceCache ? m_cache.deltaR2(p1, p2) : deltaR2(p1, p2);
   // TODO: use fpcompare utilities
   return (dR2 < (dRMax*dRMax) && dR2 > (dRMin*dRMin));
 }
@@ -397,8 +1519,7 @@ bool OverlapRemovalTool::isInputObject(const xAOD::IParticle* obj)
 bool OverlapRemovalTool::isRejectedObject(const xAOD::IParticle* obj)
 {
   // Reversing the logic
-  static SG::AuxElement::Decorator<int> overlapDec(m_overlapLabel);
-  if(overlapDec(*obj) == 1) return true;
+  if((*m_config->overlapDec)(*obj) == 1) return true;
   //static SG::AuxElement::Accessor<int> overlapAcc(m_overlapLabel);
   //if(overlapAcc.isAvailable(*obj) && overlapAcc(*obj) == 1)
   //  return true;
@@ -428,10 +1549,35 @@ bool OverlapRemovalTool::isRejectedObject(const xAOD::IParticle* obj)
   passAcc(*obj) = pass;
 }*/
 //-----------------------------------------------------------------------------
+int OverlapRemovalTool::getOverlapDecoration(const xAOD::IParticle* obj)
+{
+  return (*m_config->overlapDec)(*obj);
+}
+//-----------------------------------------------------------------------------
+uint32_t OverlapRemovalTool::getPartnerDecoration(const xAOD::IParticle* obj)
+{
+  if(!m_config->partnerDec || !m_config->partnerDec->isAvailable(*obj))
+    return noPartner;
+  return (*m_config->partnerDec)(*obj);
+}
+//-----------------------------------------------------------------------------
+const uint32_t OverlapRemovalTool::partnerIndexMask;
+const uint32_t OverlapRemovalTool::noPartner;
+const size_t OverlapRemovalTool::noOverlap;
+uint32_t OverlapRemovalTool::encodePartner(ORInputSlot slot, size_t position)
+{
+  const uint32_t compactIndex = position < partnerIndexMask ?
+    static_cast<uint32_t>(position) : partnerIndexMask;
+  // The slot is shifted by one so that a zero code means no partner
+  return (static_cast<uint32_t>(slot + 1) << 16) | compactIndex;
+}
+//-----------------------------------------------------------------------------
 void OverlapRemovalTool::setOverlapDecoration(const xAOD::IParticle* obj,
-                                              int overlaps)
+                                              int overlaps, uint32_t partner)
 {
-  static SG::AuxElement::Decorator<int> overlapDec(m_overlapLabel);
-  overlapDec(*obj) = overlaps;
+  (*m_config->overlapDec)(*obj) = overlaps;
+  // Always written, so no partner is left over from an earlier decision
+  if(m_config->partnerDec)
+    (*m_config->partnerDec)(*obj) = overlaps ? partner : noPartner;
 }
 
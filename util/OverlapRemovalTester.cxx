@@ -1,11 +1,23 @@
 // System includes
 #include <memory>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 // ROOT includes
 #include "TFile.h"
+#include "TChain.h"
+#include "TEntryList.h"
 #include "TError.h"
 #include "TString.h"
+#include "TStopwatch.h"
 
 // Infrastructure includes
 #ifdef ROOTCORE
@@ -37,6 +49,123 @@
     }                                                \
   } while( false )
 
+/// Size of the TTreeCache used when reading an event list
+const Long64_t cacheSize = 30*1024*1024;
+
+
+/// Summary of a (partial) run, written per shard and merged afterwards.
+/// The text format is one "key values..." record per line.
+struct RunSummary
+{
+  RunSummary()
+    : events(0), realTime(0), cpuTime(0), maxRealTime(0),
+      denseEvents(0), denseReadTime(0), sparseEvents(0), sparseReadTime(0)
+  {}
+  /// Input ranges processed, e.g. "shard 1/4 entries [250,500)"
+  std::vector<std::string> ranges;
+  Long64_t events;
+  double realTime;
+  double cpuTime;
+  /// Longest single-shard wall time; the wall time of a parallel run
+  double maxRealTime;
+  /// Events read right after the previous entry, and their read time
+  Long64_t denseEvents;
+  double denseReadTime;
+  /// Events read after a jump over skipped entries, and their read time
+  Long64_t sparseEvents;
+  double sparseReadTime;
+  /// Per object type: total and overlapping objects
+  std::map<std::string, std::pair<Long64_t, Long64_t> > objects;
+
+  /// Add the content of another summary
+  void add(const RunSummary& other)
+  {
+    ranges.insert(ranges.end(), other.ranges.begin(), other.ranges.end());
+    events += other.events;
+    realTime += other.realTime;
+    cpuTime += other.cpuTime;
+    if(other.maxRealTime > maxRealTime) maxRealTime = other.maxRealTime;
+    denseEvents += other.denseEvents;
+    denseReadTime += other.denseReadTime;
+    sparseEvents += other.sparseEvents;
+    sparseReadTime += other.sparseReadTime;
+    for(const auto& obj : other.objects){
+      objects[obj.first].first += obj.second.first;
+      objects[obj.first].second += obj.second.second;
+    }
+  }
+
+  bool write(const std::string& fileName) const
+  {
+    std::ofstream out(fileName.c_str());
+    if(!out) return false;
+    for(const auto& range : ranges) out << "range " << range << "\n";
+    out << "events " << events << "\n";
+    out << "realTime " << realTime << "\n";
+    out << "cpuTime " << cpuTime << "\n";
+    out << "maxRealTime " << maxRealTime << "\n";
+    out << "dense " << denseEvents << " " << denseReadTime << "\n";
+    out << "sparse " << sparseEvents << " " << sparseReadTime << "\n";
+    for(const auto& obj : objects){
+      out << "objects " << obj.first << " " << obj.second.first << " "
+          << obj.second.second << "\n";
+    }
+    return out.good();
+  }
+
+  bool read(const std::string& fileName)
+  {
+    std::ifstream in(fileName.c_str());
+    if(!in) return false;
+    std::string key;
+    while(in >> key){
+      if(key == "range"){
+        std::string range;
+        std::getline(in >> std::ws, range);
+        ranges.push_back(range);
+      }
+      else if(key == "events") in >> events;
+      else if(key == "realTime") in >> realTime;
+      else if(key == "cpuTime") in >> cpuTime;
+      else if(key == "maxRealTime") in >> maxRealTime;
+      else if(key == "dense") in >> denseEvents >> denseReadTime;
+      else if(key == "sparse") in >> sparseEvents >> sparseReadTime;
+      else if(key == "objects"){
+        std::string type;
+        in >> type >> objects[type].first >> objects[type].second;
+      }
+      else return false;
+    }
+    return true;
+  }
+
+  void print(const char* APP_NAME) const
+  {
+    for(const auto& range : ranges) Info(APP_NAME, "  %s", range.c_str());
+    Info(APP_NAME, "  events %lld, real time %.2f s, cpu time %.2f s",
+         events, realTime, cpuTime);
+    if(cpuTime > 0){
+      Info(APP_NAME, "  throughput %.1f events/s per core, "
+           "%.1f events/s wall", events/cpuTime,
+           maxRealTime > 0 ? events/maxRealTime : 0.);
+    }
+    if(denseEvents > 0){
+      Info(APP_NAME, "  dense reads: %lld events, %.2f s, %.1f events/s",
+           denseEvents, denseReadTime,
+           denseReadTime > 0 ? denseEvents/denseReadTime : 0.);
+    }
+    if(sparseEvents > 0){
+      Info(APP_NAME, "  sparse reads: %lld events, %.2f s, %.1f events/s",
+           sparseEvents, sparseReadTime,
+           sparseReadTime > 0 ? sparseEvents/sparseReadTime : 0.);
+    }
+    for(const auto& obj : objects){
+      Info(APP_NAME, "  %s: %lld objects, %lld overlapping",
+           obj.first.c_str(), obj.second.first, obj.second.second);
+    }
+  }
+};
+
 
 void printObj(const char* APP_NAME, const char* type,
               const xAOD::IParticle* obj)
@@ -51,6 +180,147 @@ void printObj(const char* APP_NAME, const char* type,
   //               passAcc.isAvailable(*obj)? passAcc(*obj) : -1);
 }
 
+/// Count all and overlapping objects of a container, dumping them if asked
+template<typename ContainerType>
+void processObjs(const char* APP_NAME, const char* type,
+                 const ContainerType* container, bool dump,
+                 RunSummary& summary)
+{
+  static SG::AuxElement::ConstAccessor<int> overlapAcc("overlaps");
+  std::pair<Long64_t, Long64_t>& counts = summary.objects[type];
+  for(const auto obj : *container){
+    if(dump) printObj(APP_NAME, type, obj);
+    ++counts.first;
+    if(overlapAcc.isAvailable(*obj) && overlapAcc(*obj)) ++counts.second;
+  }
+}
+
+/// Add an input file, or all files listed in a .txt/.list file
+bool addInput(const char* APP_NAME, const std::string& name,
+              std::vector<std::string>& files)
+{
+  const bool isList =
+    (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0) ||
+    (name.size() > 5 && name.compare(name.size() - 5, 5, ".list") == 0);
+  if(!isList){
+    files.push_back(name);
+    return true;
+  }
+  std::ifstream in(name.c_str());
+  if(!in){
+    Error(APP_NAME, "Cannot open file list %s", name.c_str());
+    return false;
+  }
+  std::string line;
+  while(std::getline(in, line)){
+    // Skip blank lines and comments
+    const size_t start = line.find_first_not_of(" \t");
+    if(start == std::string::npos || line[start] == '#') continue;
+    const size_t end = line.find_last_not_of(" \t\r");
+    files.push_back(line.substr(start, end - start + 1));
+  }
+  return true;
+}
+
+/// Parse a non-negative entry number, rejecting anything else
+bool parseEntry(const char* text, Long64_t& entry)
+{
+  char* end = 0;
+  const long long value = strtoll(text, &end, 10);
+  if(end == text || *end != '\0' || value < 0) return false;
+  entry = value;
+  return true;
+}
+
+/// Read an event list. ROOT files ("file.root[:name]") hold a TEntryList,
+/// named "elist" by default. Text files hold one entry number or one
+/// "run event" pair per line. Returns the global chain entries in entries,
+/// and the run/event pairs still to be located in runEvents.
+bool readEventList(const char* APP_NAME, const std::string& name,
+                   TChain& chain, std::vector<Long64_t>& entries,
+                   std::set<std::pair<UInt_t, ULong64_t> >& runEvents)
+{
+  const size_t rootPos = name.find(".root");
+  if(rootPos != std::string::npos){
+    const size_t colon = name.find(':', rootPos);
+    const std::string fileName = name.substr(0, colon);
+    const std::string listName =
+      colon == std::string::npos ? "elist" : name.substr(colon + 1);
+    std::unique_ptr<TFile> file(TFile::Open(fileName.c_str(), "READ"));
+    if(!file.get() || file->IsZombie()){
+      Error(APP_NAME, "Cannot open event list file %s", fileName.c_str());
+      return false;
+    }
+    TEntryList* list = dynamic_cast<TEntryList*>(file->Get(listName.c_str()));
+    if(!list){
+      Error(APP_NAME, "No TEntryList %s in %s", listName.c_str(),
+            fileName.c_str());
+      return false;
+    }
+    // Let the chain translate the (per-tree) list into global entries
+    chain.SetEntryList(list);
+    for(Long64_t i = 0; i < list->GetN(); ++i)
+      entries.push_back(chain.GetEntryNumber(i));
+    chain.SetEntryList(0);
+    return true;
+  }
+  std::ifstream in(name.c_str());
+  if(!in){
+    Error(APP_NAME, "Cannot open event list %s", name.c_str());
+    return false;
+  }
+  std::string line;
+  while(std::getline(in, line)){
+    const size_t start = line.find_first_not_of(" \t");
+    if(start == std::string::npos || line[start] == '#') continue;
+    std::istringstream fields(line);
+    ULong64_t first = 0, second = 0;
+    if(!(fields >> first)){
+      Error(APP_NAME, "Invalid event list line: %s", line.c_str());
+      return false;
+    }
+    if(fields >> second) runEvents.insert(std::make_pair(first, second));
+    else entries.push_back(first);
+  }
+  return true;
+}
+
+/// Write the selected entries as a text event list of entry numbers
+bool writeEventList(const std::string& name,
+                    const std::vector<Long64_t>& entries)
+{
+  std::ofstream out(name.c_str());
+  if(!out) return false;
+  for(const auto entry : entries) out << entry << "\n";
+  return out.good();
+}
+
+void usage(const char* APP_NAME)
+{
+  Error(APP_NAME, "  Usage: %s [options] <xAOD file or file list> "
+        "[more files] [max events]", APP_NAME);
+  Error(APP_NAME, "  File lists (.txt or .list) hold one file name per line");
+  Error(APP_NAME, "  Options:");
+  Error(APP_NAME, "    --first F    first entry to process (default 0)");
+  Error(APP_NAME, "    --last L     stop before entry L (default: all)");
+  Error(APP_NAME, "    --shard i/N  process the i-th of N equal blocks "
+        "of the entry range");
+  Error(APP_NAME, "    --events E   only process the events of list E: a text "
+        "file of entry numbers or \"run event\" pairs, or a TEntryList "
+        "given as file.root[:name]");
+  Error(APP_NAME, "                 Run/event pairs are located by reading "
+        "the EventInfo of the whole entry range, in every shard");
+  Error(APP_NAME, "    --save-events S  write the selected entry numbers to "
+        "S, to locate run/event pairs once and pass S to the shards");
+  Error(APP_NAME, "    --output S   write the run summary to file S");
+  Error(APP_NAME, "    --quiet      no per-event printout");
+  Error(APP_NAME, "    --fast       use the fast matching engine");
+  Error(APP_NAME, "    --validate   run both matching engines and fail on "
+        "any mismatching decision or partner");
+  Error(APP_NAME, "  Merge mode: %s --merge <summary files> "
+        "[--output S]", APP_NAME);
+}
+
 
 int main( int argc, char* argv[] )
 {
@@ -58,41 +328,201 @@ int main( int argc, char* argv[] )
   // The application's name
   const char* APP_NAME = argv[ 0 ];
 
+  // Parse the command line
+  std::vector<std::string> files;
+  Long64_t maxEvents = -1;
+  Long64_t first = 0;
+  Long64_t last = -1;
+  int shard = 0;
+  int nShards = 1;
+  std::string outputName;
+  std::string eventListName;
+  std::string saveEventsName;
+  bool dump = true;
+  bool fastMatching = false;
+  bool validate = false;
+  bool merge = false;
+  for(int i = 1; i < argc; ++i){
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if((arg == "--first" || arg == "--last") && hasValue){
+      if(!parseEntry(argv[++i], arg == "--first" ? first : last)){
+        Error(APP_NAME, "Invalid entry number for %s: %s", arg.c_str(),
+              argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--output" && hasValue) outputName = argv[++i];
+    else if(arg == "--events" && hasValue) eventListName = argv[++i];
+    else if(arg == "--save-events" && hasValue) saveEventsName = argv[++i];
+    else if(arg == "--quiet") dump = false;
+    else if(arg == "--fast") fastMatching = true;
+    else if(arg == "--validate") validate = true;
+    else if(arg == "--merge") merge = true;
+    else if(arg == "--shard" && hasValue){
+      char extra = 0;
+      if(sscanf(argv[++i], "%d/%d%c", &shard, &nShards, &extra) != 2 ||
+         nShards < 1 || shard < 0 || shard >= nShards){
+        Error(APP_NAME, "Invalid shard specification: %s", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg.compare(0, 2, "--") == 0){
+      Error(APP_NAME, "Unknown option: %s", arg.c_str());
+      usage(APP_NAME);
+      return 1;
+    }
+    // A plain number after the inputs is the maximum number of events
+    else if(!files.empty() && !merge &&
+            arg.find_first_not_of("0123456789") == std::string::npos){
+      maxEvents = atoll(arg.c_str());
+    }
+    else if(merge) files.push_back(arg);
+    else if(!addInput(APP_NAME, arg, files)) return 1;
+  }
+
+  if(last >= 0 && first > last){
+    Error(APP_NAME, "First entry %lld is after last entry %lld", first, last);
+    return 1;
+  }
+
+  if(!saveEventsName.empty() && eventListName.empty()){
+    Error(APP_NAME, "--save-events needs an event list given with --events");
+    return 1;
+  }
+
   // Check if we received a file name
-  if(argc < 2) {
+  if(files.empty()) {
     Error( APP_NAME, "No file name received!" );
-    Error( APP_NAME, "  Usage: %s [xAOD file name]", APP_NAME );
+    usage(APP_NAME);
     return 1;
   }
 
+  // Merge mode: combine the summaries of several shards
+  if(merge){
+    RunSummary total;
+    for(const auto& fileName : files){
+      RunSummary part;
+      if(!part.read(fileName)){
+        Error(APP_NAME, "Cannot read run summary %s", fileName.c_str());
+        return 1;
+      }
+      total.add(part);
+    }
+    Info(APP_NAME, "Merged %i run summaries", static_cast<int>(files.size()));
+    total.print(APP_NAME);
+    if(!outputName.empty()) CHECK( total.write(outputName) );
+    return 0;
+  }
+
   // Initialise the application
   CHECK( xAOD::Init(APP_NAME) );
   StatusCode::enableFailure();
 
-  // Open the input file
-  const TString fileName = argv[ 1 ];
-  Info(APP_NAME, "Opening file: %s", fileName.Data());
-  std::auto_ptr<TFile> ifile(TFile::Open(fileName, "READ"));
-  CHECK( ifile.get() );
+  // Chain the input files
+  TChain chain("CollectionTree");
+  for(const auto& fileName : files){
+    Info(APP_NAME, "Adding file: %s", fileName.c_str());
+    CHECK( chain.Add(fileName.c_str(), -1) );
+  }
+
+  // Read the event list, if any
+  const bool useEventList = !eventListName.empty();
+  std::vector<Long64_t> eventList;
+  std::set<std::pair<UInt_t, ULong64_t> > runEvents;
+  if(useEventList){
+    CHECK( readEventList(APP_NAME, eventListName, chain,
+                         eventList, runEvents) );
+  }
 
   // Create a TEvent object
   xAOD::TEvent event(xAOD::TEvent::kClassAccess);
-  CHECK( event.readFrom(ifile.get()) );
-  Info(APP_NAME, "Number of events in the file: %i",
-       static_cast<int>(event.getEntries()));
+  CHECK( event.readFrom(&chain) );
+  const Long64_t nEntries = event.getEntries();
+  Info(APP_NAME, "Number of events in the input: %lld", nEntries);
+
+  if(last < 0 || last > nEntries) last = nEntries;
+  if(first > last) first = last;
+
+  // Locate run/event pairs by scanning the EventInfo of the entry range.
+  // The scan runs without a cache, so the cache used by the event loop
+  // learns the branches of the full event. Every shard repeats the scan of
+  // the whole range, so large lists are best located once with
+  // --save-events and the saved entry list given to the shards.
+  if(!runEvents.empty()){
+    chain.SetCacheSize(0);
+    Info(APP_NAME, "Locating %i run/event pairs",
+         static_cast<int>(runEvents.size()));
+    for(Long64_t entry = first; entry < last; ++entry){
+      event.getEntry(entry);
+      const xAOD::EventInfo* ei = 0;
+      CHECK( event.retrieve(ei, "EventInfo") );
+      if(runEvents.count(std::make_pair(ei->runNumber(), ei->eventNumber())))
+        eventList.push_back(entry);
+    }
+  }
 
-  // Decide how many events to run over
-  Long64_t entries = event.getEntries();
-  if(argc > 2) {
-    const Long64_t e = atoll(argv[2]);
-    if(e < entries) {
-      entries = e;
+  // Keep the listed entries inside the entry range, in file order
+  if(useEventList){
+    std::sort(eventList.begin(), eventList.end());
+    eventList.erase(std::unique(eventList.begin(), eventList.end()),
+                    eventList.end());
+    eventList.erase(std::lower_bound(eventList.begin(), eventList.end(),
+                                     last), eventList.end());
+    eventList.erase(eventList.begin(),
+                    std::lower_bound(eventList.begin(), eventList.end(),
+                                     first));
+    Info(APP_NAME, "Event list selects %i of %lld entries",
+         static_cast<int>(eventList.size()), last - first);
+    if(!saveEventsName.empty()){
+      Info(APP_NAME, "Writing the selected entries to %s",
+           saveEventsName.c_str());
+      CHECK( writeEventList(saveEventsName, eventList) );
     }
   }
 
+  // Decide which events to run over. The shard blocks only depend on the
+  // selection, so every shard of a dataset is assigned deterministically.
+  const Long64_t nSelected = useEventList ? eventList.size() : last - first;
+  Long64_t begin = nSelected * shard / nShards;
+  Long64_t end = nSelected * (shard + 1) / nShards;
+  if(maxEvents >= 0 && end - begin > maxEvents) end = begin + maxEvents;
+  const Long64_t firstEntry = useEventList ?
+    (begin < end ? eventList[begin] : first) : first + begin;
+  const Long64_t lastEntry = useEventList ?
+    (begin < end ? eventList[end - 1] + 1 : first) : first + end;
+  Info(APP_NAME, "Processing shard %i/%i: entries [%lld,%lld)",
+       shard, nShards, firstEntry, lastEntry);
+
+  // Tune the cache for sparse reads: keep the selected entries on the
+  // chain so the cache skips clusters without any of them, and learn the
+  // branches from the first entry instead of a learning phase which would
+  // read ahead many unselected entries.
+  std::unique_ptr<TEntryList> selection;
+  if(useEventList){
+    selection.reset(new TEntryList("selection", "Selected entries"));
+    for(Long64_t pos = begin; pos < end; ++pos)
+      selection->Enter(eventList[pos], &chain);
+    chain.SetEntryList(selection.get());
+    chain.SetCacheSize(cacheSize);
+    chain.SetCacheLearnEntries(1);
+  }
+  // Restrict the cache to the entries we actually read
+  chain.SetCacheEntryRange(firstEntry, lastEntry);
+
+  RunSummary summary;
+  summary.ranges.push_back
+    (TString::Format("shard %i/%i entries [%lld,%lld)%s", shard, nShards,
+                     firstEntry, lastEntry,
+                     useEventList ? " (event list)" : "").Data());
+
   // Create and configure the tool
   OverlapRemovalTool orTool("OverlapRemovalTool");
   CHECK( orTool.setProperty("InputLabel", "") );
+  CHECK( orTool.setProperty("FastMatching", fastMatching) );
+  CHECK( orTool.setProperty("ValidationMode", validate) );
+  // Record the partners when validating, so they are compared as well
+  if(validate) CHECK( orTool.setProperty("PartnerLabel", "overlapPartner") );
   orTool.msg().setLevel(MSG::DEBUG);
 
   // Initialize the tool
@@ -100,19 +530,24 @@ int main( int argc, char* argv[] )
 
   // Loop over the events
   std::cout << "Starting loop" << std::endl;
-  for(Long64_t entry = 0; entry < entries; ++entry){
-
+  TStopwatch timer;
+  TStopwatch readTimer;
+  timer.Start();
+  // A listed entry counts as sparse if entries were skipped before it,
+  // including the first one when the list doesn't start at the first entry
+  // of the range. Plain ranges are read densely.
+  Long64_t prevEntry = (useEventList ? first : firstEntry) - 1;
+  for(Long64_t pos = begin; pos < end; ++pos){
+
+    const Long64_t entry = useEventList ? eventList[pos] : first + pos;
+    const bool sparse = entry != prevEntry + 1;
+    prevEntry = entry;
+    readTimer.Start();
     event.getEntry(entry);
 
-    // Print some event information for fun
+    // Get the event information
     const xAOD::EventInfo* ei = 0;
     CHECK( event.retrieve(ei, "EventInfo") );
-    Info(APP_NAME,
-         "===>>>  start processing event #%i, "
-         "run #%i %i events processed so far  <<<===",
-         static_cast<int>(ei->eventNumber()),
-         static_cast<int>(ei->runNumber()),
-         static_cast<int>(entry));
 
     // Get electrons
     const xAOD::ElectronContainer* electrons = 0;
@@ -130,11 +565,31 @@ int main( int argc, char* argv[] )
     const xAOD::PhotonContainer* photons = 0;
     CHECK( event.retrieve(photons, "PhotonCollection") );
 
-    Info(APP_NAME,
-         "  nEle %lu, nMuo %lu, nJet %lu, nTau %lu, nPho %lu",
-         electrons->size(), muons->size(),
-         jets->size(), taus->size(),
-         photons->size());
+    // Account the read time to dense or sparse access
+    readTimer.Stop();
+    if(sparse){
+      ++summary.sparseEvents;
+      summary.sparseReadTime += readTimer.RealTime();
+    }
+    else{
+      ++summary.denseEvents;
+      summary.denseReadTime += readTimer.RealTime();
+    }
+
+    // Print some event information for fun
+    if(dump){
+      Info(APP_NAME,
+           "===>>>  start processing event #%i, "
+           "run #%i %i events processed so far  <<<===",
+           static_cast<int>(ei->eventNumber()),
+           static_cast<int>(ei->runNumber()),
+           static_cast<int>(pos - begin));
+      Info(APP_NAME,
+           "  nEle %lu, nMuo %lu, nJet %lu, nTau %lu, nPho %lu",
+           electrons->size(), muons->size(),
+           jets->size(), taus->size(),
+           photons->size());
+    }
 
     // Apply the overlap removal to all objects (dumb example)
     CHECK( orTool.removeOverlaps(electrons, muons, jets, taus, photons) );
@@ -144,30 +599,49 @@ int main( int argc, char* argv[] )
     //
 
     // electrons
-    Info(APP_NAME, "Now dumping the electrons");
-    for(auto electron : *electrons)
-      printObj(APP_NAME, "ele", electron);
+    if(dump) Info(APP_NAME, "Now dumping the electrons");
+    processObjs(APP_NAME, "ele", electrons, dump, summary);
 
     // muons
-    Info(APP_NAME, "Now dumping the muons");
-    for(auto muon : *muons)
-      printObj(APP_NAME, "muo", muon);
+    if(dump) Info(APP_NAME, "Now dumping the muons");
+    processObjs(APP_NAME, "muo", muons, dump, summary);
 
     // jets
-    Info(APP_NAME, "Now dumping the jets");
-    for(auto jet : *jets)
-      printObj(APP_NAME, "jet", jet);
+    if(dump) Info(APP_NAME, "Now dumping the jets");
+    processObjs(APP_NAME, "jet", jets, dump, summary);
 
     // taus
-    Info(APP_NAME, "Now dumping the taus");
-    for(auto tau : *taus)
-      printObj(APP_NAME, "tau", tau);
+    if(dump) Info(APP_NAME, "Now dumping the taus");
+    processObjs(APP_NAME, "tau", taus, dump, summary);
 
     // photons
-    Info(APP_NAME, "Now dumping the photons");
-    for(auto photon : *photons)
-      printObj(APP_NAME, "pho", photon);
+    if(dump) Info(APP_NAME, "Now dumping the photons");
+    processObjs(APP_NAME, "pho", photons, dump, summary);
 
+    ++summary.events;
+  }
+  timer.Stop();
+  chain.SetEntryList(0);
+  summary.realTime = timer.RealTime();
+  summary.cpuTime = timer.CpuTime();
+  summary.maxRealTime = summary.realTime;
+
+  Info(APP_NAME, "Run summary");
+  summary.print(APP_NAME);
+  if(!outputName.empty()){
+    Info(APP_NAME, "Writing run summary to %s", outputName.c_str());
+    CHECK( summary.write(outputName) );
+  }
+
+  // The matching engines must agree on every decision and partner
+  if(validate){
+    const unsigned long mismatches = orTool.validationMismatches();
+    if(mismatches > 0){
+      Error(APP_NAME, "Validation found %lu mismatching decisions or partners",
+            mismatches);
+      return 1;
+    }
+    Info(APP_NAME, "Validation found no mismatching decisions or partners");
   }
 
   return 0;